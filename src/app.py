@@ -42,20 +42,31 @@ class BaseApp:
         stream.seek(len(prefix) + 1)
         return prefix
 
+    def prepare(self, keystore, network, show_loader, communicate):
+        """
+        Cheap part of init() called for every app
+        when new key is loaded or a different network is selected.
+        init() itself is called later, when the app menu is opened
+        or a host command is routed to the app,
+        so button, prefixes and can_process() should only rely
+        on the data set here.
+        """
+        self.keystore = keystore
+        self.network = network
+        self.show_loader = show_loader
+        self.communicate = communicate
+
     def init(self, keystore, network, show_loader, communicate):
         """
-        This method is called when new key is loaded
-        or a different network is selected.
+        This method is called before first use of the app
+        after new key is loaded or a different network is selected.
         `show_loader` is a function that is used to display a loader while processing data
         `communicate` is an async function that allows cross-app communication with another apps.
         Pass a readable stream to `communicate` function to simulate host command processing.
         Optionally you can pass a name of the app to communicate with
         by calling i.e. `await self.communicate(stream, app="wallets")`
         """
-        self.keystore = keystore
-        self.network = network
-        self.show_loader = show_loader
-        self.communicate = communicate
+        self.prepare(keystore, network, show_loader, communicate)
 
     def wipe(self):
         """
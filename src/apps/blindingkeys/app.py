@@ -21,8 +21,8 @@ class BlindingKeysApp(BaseApp):
     def __init__(self, path):
         pass
 
-    def init(self, *args, **kwargs):
-        super().init(*args, **kwargs)
+    def prepare(self, *args, **kwargs):
+        super().prepare(*args, **kwargs)
         if is_liquid(self.network):
             self.button = self.BTNTEXT
         else:
@@ -25,16 +25,20 @@ class WalletsApp(BaseApp):
     def name(self):
         return self.manager.name if self.manager else None
 
-    def init(self, keystore, network, *args, **kwargs):
-        """Loads or creates default wallets for new keystore or network"""
+    def prepare(self, keystore, network, *args, **kwargs):
+        """Selects the wallet manager, wallets are loaded in init()"""
         old_network = self.network if hasattr(self, "network") else None
-        super().init(keystore, network, *args, **kwargs)
+        super().prepare(keystore, network, *args, **kwargs)
         # switching the network - use different wallet managers for liquid or btc
         if old_network is None or self.manager is None or is_liquid(old_network) != is_liquid(network):
             if is_liquid(network):
                 self.manager = LWalletManager(self.root_path)
             else:
                 self.manager = WalletManager(self.root_path)
+
+    def init(self, keystore, network, *args, **kwargs):
+        """Loads or creates default wallets for new keystore or network"""
+        self.prepare(keystore, network, *args, **kwargs)
         return self.manager.init(keystore, network, *args, **kwargs)
 
     async def menu(self, *args, **kwargs):
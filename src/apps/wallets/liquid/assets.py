@@ -0,0 +1,251 @@
+import os
+import hmac
+import platform
+from embit import compact
+from helpers import aead_encrypt, aead_decrypt, tagged_hash
+
+
+class AssetIndex:
+    """
+    On-flash index of asset labels: 32-byte asset id -> label.
+    Every asset is stored in a fixed-size record encrypted with the key,
+    records are sorted by a keyed hash of the asset id
+    so lookups are a binary search reading a few records from flash.
+    New labels are appended to a small journal that is merged
+    into the sorted file when it grows above JOURNAL_LIMIT records.
+    Labels longer than LABEL_SIZE are kept in full in the overflow file,
+    the record only has a flag and the beginning of the label.
+    """
+    # label is padded to fixed length so all records have the same size
+    LABEL_SIZE = 30
+    # <compact-len:1><lookup key:16><iv:16><ct: asset|flags|label|pad = 64><hmac:32>
+    RECORD_SIZE = 1 + 16 + 16 + 64 + 32
+    KEY_OFFSET = 1
+    KEY_SIZE = 16
+    JOURNAL_LIMIT = 16
+    # full label is in the overflow file
+    FLAG_OVERFLOW = 1
+
+    def __init__(self, path, key):
+        # path without extension, .idx - sorted records, .log - journal,
+        # .lbl - long labels
+        self.path = path
+        self.key = key
+        self._lookup_key = tagged_hash("asset index", key)
+        # journal records by lookup key, loaded on first use
+        self._journal_cache = None
+        self.recover()
+
+    @property
+    def index_file(self):
+        return self.path + ".idx"
+
+    @property
+    def journal_file(self):
+        return self.path + ".log"
+
+    @property
+    def overflow_file(self):
+        return self.path + ".lbl"
+
+    @property
+    def tmp_file(self):
+        return self.path + ".tmp"
+
+    def recover(self):
+        """
+        Finishes a merge interrupted by reset.
+        The sorted file is removed only after the new one is written,
+        so without the sorted file the temp file is complete.
+        The journal is kept until the end of the merge and merged again.
+        """
+        if not platform.file_exists(self.tmp_file):
+            return
+        if platform.file_exists(self.index_file):
+            os.remove(self.tmp_file)
+        else:
+            os.rename(self.tmp_file, self.index_file)
+
+    @classmethod
+    def fit_label(cls, label):
+        """Cuts the label to LABEL_SIZE bytes without breaking utf-8 characters"""
+        while len(label.encode()) > cls.LABEL_SIZE:
+            label = label[:-1]
+        return label
+
+    def lookup_key(self, asset):
+        return hmac.new(self._lookup_key, asset, digestmod="sha256").digest()[:self.KEY_SIZE]
+
+    def _pack(self, asset, label, flags=0):
+        lbl = self.fit_label(label).encode()
+        plaintext = asset + bytes([flags]) + lbl + b"\x00" * (self.LABEL_SIZE - len(lbl))
+        rec = aead_encrypt(self.key, self.lookup_key(asset), plaintext)
+        assert len(rec) == self.RECORD_SIZE
+        return rec
+
+    def _unpack(self, rec):
+        key, plaintext = aead_decrypt(rec, self.key)
+        asset = plaintext[:32]
+        if key != self.lookup_key(asset):
+            raise ValueError("Invalid asset record")
+        if plaintext[32] & self.FLAG_OVERFLOW:
+            label = self._overflow_label(key)
+            if label is not None:
+                return asset, label
+        return asset, plaintext[33:].rstrip(b"\x00").decode()
+
+    def _overflow_label(self, key):
+        """Finds the latest full label in the overflow file"""
+        label = None
+        if not platform.file_exists(self.overflow_file):
+            return label
+        with open(self.overflow_file, "rb") as f:
+            while True:
+                try:
+                    l = compact.read_from(f)
+                except:
+                    break
+                rec = f.read(l)
+                if len(rec) < l:
+                    break
+                if rec[self.KEY_OFFSET:self.KEY_OFFSET+self.KEY_SIZE] != key:
+                    continue
+                _, plaintext = aead_decrypt(rec, self.key)
+                label = plaintext[32:].decode()
+        return label
+
+    def _record(self, asset, label):
+        """Packs the record, long labels go to the overflow file first"""
+        if len(label.encode()) <= self.LABEL_SIZE:
+            return self._pack(asset, label)
+        rec = aead_encrypt(self.key, self.lookup_key(asset), asset + label.encode())
+        with open(self.overflow_file, "ab") as f:
+            f.write(compact.to_bytes(len(rec)))
+            f.write(rec)
+        return self._pack(asset, label, self.FLAG_OVERFLOW)
+
+    @staticmethod
+    def _size(fname):
+        try:
+            return os.stat(fname)[6]
+        except OSError:
+            return 0
+
+    def _count(self, fname):
+        return self._size(fname) // self.RECORD_SIZE
+
+    def _read_key(self, f, i):
+        f.seek(i * self.RECORD_SIZE + self.KEY_OFFSET)
+        return f.read(self.KEY_SIZE)
+
+    def _journal(self):
+        """Returns journal as a dict lookup key -> latest record"""
+        if self._journal_cache is not None:
+            return self._journal_cache
+        res = {}
+        if self._count(self.journal_file) > 0:
+            with open(self.journal_file, "rb") as f:
+                while True:
+                    rec = f.read(self.RECORD_SIZE)
+                    if len(rec) < self.RECORD_SIZE:
+                        break
+                    res[rec[self.KEY_OFFSET:self.KEY_OFFSET+self.KEY_SIZE]] = rec
+        self._journal_cache = res
+        return res
+
+    def _append(self, asset, label):
+        rec = self._record(asset, label)
+        with open(self.journal_file, "ab") as f:
+            f.write(rec)
+        self._journal()[rec[self.KEY_OFFSET:self.KEY_OFFSET+self.KEY_SIZE]] = rec
+
+    def _search(self, key):
+        """Binary search of the record in the sorted file"""
+        n = self._count(self.index_file)
+        if n == 0:
+            return None
+        with open(self.index_file, "rb") as f:
+            lo, hi = 0, n
+            while lo < hi:
+                mid = (lo + hi) // 2
+                k = self._read_key(f, mid)
+                if k == key:
+                    f.seek(mid * self.RECORD_SIZE)
+                    return f.read(self.RECORD_SIZE)
+                if k < key:
+                    lo = mid + 1
+                else:
+                    hi = mid
+        return None
+
+    def get(self, asset, default=None):
+        """Returns label of the asset"""
+        key = self.lookup_key(asset)
+        rec = self._journal().get(key)
+        if rec is None:
+            rec = self._search(key)
+        if rec is None:
+            return default
+        return self._unpack(rec)[1]
+
+    def add(self, asset, label, sync=True):
+        """Adds or replaces the label of the asset"""
+        self._append(asset, label)
+        if self._count(self.journal_file) >= self.JOURNAL_LIMIT:
+            self.merge()
+        if sync:
+            platform.sync()
+
+    def update(self, assets):
+        """Adds labels from {asset: label} dict with a single merge"""
+        for asset in assets:
+            self._append(asset, assets[asset])
+        self.merge()
+        platform.sync()
+
+    def merge(self):
+        """
+        Merges the journal into the sorted file in one sequential pass.
+        New sorted file is written to the temp file first,
+        see recover() for the reset in the middle of the merge.
+        """
+        journal = self._journal()
+        if not journal:
+            return
+        pending = sorted(journal)
+        tmp = self.tmp_file
+        n = self._count(self.index_file)
+        with open(tmp, "wb") as fout:
+            if n > 0:
+                with open(self.index_file, "rb") as fin:
+                    for _ in range(n):
+                        rec = fin.read(self.RECORD_SIZE)
+                        k = rec[self.KEY_OFFSET:self.KEY_OFFSET+self.KEY_SIZE]
+                        while pending and pending[0] < k:
+                            fout.write(journal[pending.pop(0)])
+                        if pending and pending[0] == k:
+                            # replaced label
+                            rec = journal[pending.pop(0)]
+                        fout.write(rec)
+            for k in pending:
+                fout.write(journal[k])
+        # temp file must be on flash before the old index is gone
+        platform.sync()
+        if n > 0:
+            os.remove(self.index_file)
+        os.rename(tmp, self.index_file)
+        os.remove(self.journal_file)
+        self._journal_cache = {}
+
+    def items(self):
+        """Generator over all (asset, label) pairs"""
+        journal = self._journal()
+        n = self._count(self.index_file)
+        if n > 0:
+            with open(self.index_file, "rb") as f:
+                for _ in range(n):
+                    rec = f.read(self.RECORD_SIZE)
+                    if rec[self.KEY_OFFSET:self.KEY_OFFSET+self.KEY_SIZE] not in journal:
+                        yield self._unpack(rec)
+        for rec in list(journal.values()):
+            yield self._unpack(rec)
@@ -0,0 +1,150 @@
+import time
+import gc
+import secp256k1
+from embit import ec, hashes, compact
+from embit.liquid.psetview import ser_string
+from embit.psbtview import read_write
+from helpers import BufferIO
+from platform import acquire_preallocated_ram, release_preallocated_ram
+import profiler
+import ramstore
+from ..wallet import WalletError
+
+
+class BlindingEngine:
+    """
+    Blinds confidential outputs of the transaction in stages.
+    Generators, commitments and ECDH nonces of all outputs are computed
+    in batches before the outputs are written, rangeproofs are generated
+    one by one while writing, reusing the same output buffer for all of them.
+    Preallocated RAM is taken as secp256k1 scratch only while a rangeproof is signed.
+    Time spent in every stage is collected in timings (ms)
+    and recorded to the profiler on close().
+    """
+    # rangeproofs that don't fit go through a temp file
+    PROOF_BUFFER_SIZE = 0x1400
+
+    def __init__(self, txseed, tempdir):
+        self.txseed = txseed
+        self.tempdir = tempdir
+        # output index -> blinding data
+        self.outputs = {}
+        self.timings = {}
+        self._buf = None
+
+    def _done(self, stage, t0):
+        self.timings[stage] = self.timings.get(stage, 0) + time.ticks_diff(time.ticks_ms(), t0)
+        return time.ticks_ms()
+
+    def _tagged(self, tag, i):
+        return hashes.tagged_hash(tag, self.txseed + i.to_bytes(4, "little"))
+
+    def add_output(self, i, out):
+        """
+        Registers output i for blinding.
+        Returns deterministic asset and value blinding factors.
+        """
+        t0 = time.ticks_ms()
+        self.outputs[i] = {
+            "asset": out.asset,
+            "value": out.value,
+            "blinding_pubkey": out.blinding_pubkey,
+        }
+        abf = self._tagged("liquid/abf", i)
+        vbf = self._tagged("liquid/vbf", i)
+        self._done("parse", t0)
+        return abf, vbf
+
+    def prepare(self, abfs, vbfs, num_inputs):
+        """
+        Computes generators, commitments and ECDH nonces of all registered outputs.
+        abfs and vbfs are blinding factors of inputs followed by outputs
+        in the order they were added.
+        """
+        t0 = time.ticks_ms()
+        for n, i in enumerate(sorted(self.outputs)):
+            bo = self.outputs[i]
+            bo["abf"] = abfs[num_inputs + n]
+            bo["vbf"] = vbfs[num_inputs + n]
+        t0 = self._done("parse", t0)
+        for bo in self.outputs.values():
+            bo["gen"] = secp256k1.generator_generate_blinded(bo["asset"], bo["abf"])
+            bo["asset_commitment"] = secp256k1.generator_serialize(bo["gen"])
+        t0 = self._done("generators", t0)
+        for bo in self.outputs.values():
+            bo["commitment"] = secp256k1.pedersen_commit(bo["vbf"], bo["value"], bo["gen"])
+            bo["value_commitment"] = secp256k1.pedersen_commitment_serialize(bo["commitment"])
+        t0 = self._done("commitments", t0)
+        for i, bo in self.outputs.items():
+            rangeproof_nonce = self._tagged("liquid/range_proof", i)
+            pub = secp256k1.ec_pubkey_parse(bo["blinding_pubkey"])
+            bo["ecdh_pubkey"] = ec.PrivateKey(rangeproof_nonce).sec()
+            secp256k1.ec_pubkey_tweak_mul(pub, rangeproof_nonce)
+            bo["ecdh_nonce"] = hashes.double_sha256(secp256k1.ec_pubkey_serialize(pub))
+        self._done("nonces", t0)
+
+    def is_blinded(self, i):
+        return i in self.outputs
+
+    def blind(self, i, out):
+        """Fills blinding factors and commitments of the output scope"""
+        bo = self.outputs[i]
+        out.asset_blinding_factor = bo["abf"]
+        out.asset_commitment = bo["asset_commitment"]
+        out.value_blinding_factor = bo["vbf"]
+        out.value_commitment = bo["value_commitment"]
+        out.ecdh_pubkey = bo["ecdh_pubkey"]
+
+    def _sign_rangeproof(self, stream, out, bo):
+        # proprietary field that stores extra message for recepient
+        extra_message = out.unknown.get(b"\xfc\x07specter\x01", b"")
+        msg = out.asset[-32:] + out.asset_blinding_factor + extra_message
+        mem = acquire_preallocated_ram(self)
+        if mem is None:
+            raise WalletError("Preallocated memory is in use, try again later")
+        try:
+            return secp256k1.rangeproof_sign_to(
+                stream, mem[0], mem[1],
+                bo["ecdh_nonce"], out.value, bo["commitment"],
+                out.value_blinding_factor, msg,
+                out.script_pubkey.data, bo["gen"]
+            )
+        finally:
+            release_preallocated_ram(self)
+
+    def write_rangeproof(self, fout, i, out):
+        """Generates rangeproof of the blinded output and writes it to fout"""
+        t0 = time.ticks_ms()
+        bo = self.outputs.pop(i)
+        if self._buf is None:
+            self._buf = bytearray(self.PROOF_BUFFER_SIZE)
+        fname = None
+        # proof goes to RAM first to get its length
+        frp = BufferIO(memoryview(self._buf))
+        try:
+            rplen = self._sign_rangeproof(frp, out, bo)
+        except MemoryError:
+            # proof doesn't fit - drop the partial one
+            # and sign it again from scratch to the temp file
+            frp = None
+            fname = self.tempdir + "/rangeproof_out"
+            with ramstore.open(fname, "wb") as f:
+                rplen = self._sign_rangeproof(f, out, bo)
+            frp = ramstore.open(fname, "rb")
+        t0 = self._done("rangeproofs", t0)
+        try:
+            frp.seek(0)
+            ser_string(fout, b"\xfc\x04pset\x04")
+            fout.write(compact.to_bytes(rplen))
+            read_write(frp, fout, rplen)
+        finally:
+            frp.close()
+            if fname is not None:
+                ramstore.remove(fname)
+        self._done("write", t0)
+
+    def close(self):
+        self.outputs = {}
+        self._buf = None
+        for stage in self.timings:
+            profiler.record("blinding." + stage, self.timings[stage] * 1000)
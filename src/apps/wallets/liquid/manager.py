@@ -10,7 +10,9 @@ from embit.liquid.addresses import to_unconfidential
 from .wallet import WalletError, LWallet
 from helpers import is_liquid
 import secp256k1
-from platform import get_preallocated_ram
+from .blinding import BlindingEngine
+from .assets import AssetIndex
+import ramstore
 
 # asset management
 ADD_ASSET = 0xA7
@@ -46,7 +48,9 @@ class LWalletManager(WalletManager):
 
     def __init__(self, path):
         super().__init__(path)
+        # labels of assets used in current transaction
         self.assets = {}
+        self.asset_index = None
 
 
     def init(self, keystore, network, *args, **kwargs):
@@ -95,36 +99,13 @@ class LWalletManager(WalletManager):
         return super().parse_stream(stream)
 
 
-    def find_wallet_from_address(self, addr: str, paths=None, index=None):
-        if index is not None:
-            for w in self.wallets:
-                a, _ = w.get_address(index, self.network)
-                unconf_a = to_unconfidential(a)
-                if addr in [a, unconf_a]:
-                    return w, (0, index)
-        if paths is not None:
-            # we can detect the wallet from just one path
-            p = paths[0]
-            if not p.startswith("m"):
-                fingerprint = unhexlify(p[:8])
-                derivation = bip32.parse_path("m"+p[8:])
-            else:
-                fingerprint = self.keystore.fingerprint
-                derivation = bip32.parse_path(p)
-            derivation_path = DerivationPath(fingerprint, derivation)
-            for w in self.wallets:
-                der = w.descriptor.check_derivation(derivation_path)
-                if der is not None:
-                    idx, branch_idx = der
-                    a, _ = w.get_address(idx, self.network, branch_idx)
-                    unconf_a = to_unconfidential(a)
-                    if addr in [a, unconf_a]:
-                        return w, (idx, branch_idx)
-        raise WalletError("Can't find wallet owning address %s" % addr)
+    def address_matches(self, derived, addr):
+        # unconfidential address also belongs to the wallet
+        return addr in [derived, to_unconfidential(derived)]
 
 
     async def process_host_command(self, stream, show_screen):
-        platform.delete_recursively(self.tempdir)
+        ramstore.delete_recursively(self.tempdir)
         cmd, stream = self.parse_stream(stream)
         if cmd == ADD_ASSET:
             arr = stream.read().decode().split(" ")
@@ -134,8 +115,7 @@ class LWalletManager(WalletManager):
             if await show_screen(Prompt("Import asset?",
                     "Asset:\n\n"+format_addr(hexasset, letters=8, words=2)+"\n\nLabel: "+assetlbl)):
                 asset = bytes(reversed(unhexlify(hexasset)))
-                self.assets[asset] = assetlbl
-                self.save_assets()
+                self.add_asset(asset, assetlbl)
             return True
         elif cmd == DUMP_ASSETS:
             return BytesIO(self.assets_json()), {}
@@ -182,8 +162,8 @@ class LWalletManager(WalletManager):
                 if not lbl:
                     continue
                 else:
-                    self.assets[asset] = lbl
-            self.save_assets()
+                    self.add_asset(asset, lbl, sync=False)
+            platform.sync()
         # replace labels we just saved
         for sc in meta["inputs"] + meta["outputs"]:
             if sc.get("raw_asset"):
@@ -203,20 +183,20 @@ class LWalletManager(WalletManager):
         desc = "blinded(slip77(%s),%s)" % (self.keystore.slip77_key, desc)
         w = self.WalletClass.parse("Default&"+desc, path)
         # pass keystore to encrypt data
-        w.save(self.keystore)
+        w.save(self.keystore, sync=False)
         platform.sync()
         return w
 
-    def _copy_kv(self, fout, psbtv, key):
+    def _copy_kv(self, fout, index, scope, key):
         # find offset of the key if it exists
-        off = psbtv.seek_to_value(key, from_current=True)
+        off = index.seek_to_value(scope, key)
         if off is None:
             return
         # we found it - copy over
         ser_string(fout, key)
-        l = compact.read_from(psbtv.stream)
+        l = compact.read_from(index.stream)
         fout.write(compact.to_bytes(l))
-        read_write(psbtv.stream, fout, l)
+        read_write(index.stream, fout, l)
         return off
 
     async def confirm_transaction_final(self, wallets, meta, show_screen):
@@ -245,11 +225,20 @@ class LWalletManager(WalletManager):
         - metadata for tx display including warnings that require user confirmation
         """
         self.show_loader(title="Parsing transaction...")
+        self.fill_scope_avoided = 0
+        self.sign_plan = None
+        self.reset_assets()
+        # (rangeproof offset, blinding key) -> rewind result,
+        # every proof is rewound at most once per blinding key
+        rewind_cache = {}
 
         # compress = True flag will make sure large fields won't be loaded to RAM
         psbtv = self.PSBTViewClass.view(stream, compress=True)
+        plan = SignPlan(psbtv.num_inputs) if self.pipelined_signing else None
+        # offsets of all keys in all scopes
+        index = ScopeIndex(psbtv)
 
-        signed_inputs = self.check_signed_inputs(psbtv)
+        signed_inputs = self.check_signed_inputs(psbtv, index)
 
         # Start with global fields of PSBT
 
@@ -286,7 +275,8 @@ class LWalletManager(WalletManager):
         # For Liquid: same + values, assets, commitments, proofs etc.
         # At the end we should have the most complete PSBT / PSET possible
         for i in range(psbtv.num_inputs):
-            self.show_loader(title="Parsing input %d..." % i)
+            self.show_loader(title="Parsing input %d..." % i,
+                             progress=i / (psbtv.num_inputs + psbtv.num_outputs))
             # load input to memory, verify it (check prevtx hash)
             inp = psbtv.input(i)
             metainp = meta["inputs"][i]
@@ -306,32 +296,14 @@ class LWalletManager(WalletManager):
             # in Liquid we may need to rewind the rangeproof to get values
             rangeproof_offset = None
 
-            off = psbtv.seek_to_scope(i)
             # find offset of the rangeproof if it exists
-            rangeproof_offset = psbtv.seek_to_value(b'\xfc\x04pset\x0e', from_current=True)
-            # add scope offset
-            if rangeproof_offset is not None:
-                rangeproof_offset += off
-
-            # Find wallets owning the inputs and fill scope data:
-            # first we check already detected wallet owns the input
-            # as in most common case all inputs are owned by the same wallet.
-            wallet = None
-            for w in wallets:
-                # pass rangeproof offset if it's in the scope
-                if w and w.fill_scope(inp, fingerprint,
-                                stream=psbtv.stream, rangeproof_offset=rangeproof_offset):
-                    wallet = w
-                    break
-            # if it's a different wallet - go through all our wallets and check
-            if wallet is None:
-                # find wallet and append it to wallets
-                for w in self.wallets:
-                    # pass rangeproof offset if it's in the scope
-                    if w.fill_scope(inp, fingerprint,
-                                    stream=psbtv.stream, rangeproof_offset=rangeproof_offset):
-                        wallet = w
-                        break
+            rangeproof_offset = index.find(i, b'\xfc\x04pset\x0e')
+
+            # Find wallets owning the inputs and fill scope data,
+            # pass rangeproof offset if it's in the scope
+            wallet = self.find_scope_wallet(inp, fingerprint, wallets,
+                            stream=psbtv.stream, rangeproof_offset=rangeproof_offset,
+                            rewind_cache=rewind_cache)
             # get gaps
             gaps = None
             if wallet:
@@ -380,197 +352,149 @@ class LWalletManager(WalletManager):
             })
             if wallet and wallet.is_watchonly:
                 metainp["label"] += " (watch-only)"
-            if asset not in self.assets:
+            if not self.is_known_asset(asset):
                 metainp.update({"raw_asset": asset})
+            if plan is not None:
+                plan.add_input(i, inp, wallet, self.keystore)
             inp.write_to(fout, version=psbtv.version)
 
-        # if blinding seed is set we can generate all proofs
-        if blinding_seed:
-            self.show_loader(title="Doing blinding magic...")
-            blinding_out_indexes = []
-            # first we go through all outputs and update the txseed
-            for i in range(psbtv.num_outputs):
-                out = psbtv.output(i)
-                hseed.update(out.script_pubkey.serialize())
-            txseed = hseed.digest()
-            # now we can blind everything
+        engine = None
+        try:
+            # if blinding seed is set we can generate all proofs
+            if blinding_seed:
+                self.show_loader(title="Doing blinding magic...")
+                blinding_out_indexes = []
+                # first we go through all outputs and update the txseed
+                for i in range(psbtv.num_outputs):
+                    out = psbtv.output(i)
+                    hseed.update(out.script_pubkey.serialize())
+                txseed = hseed.digest()
+                engine = BlindingEngine(txseed, self.tempdir)
+                # now we can blind everything
+                for i in range(psbtv.num_outputs):
+                    out = psbtv.output(i)
+                    if out.blinding_pubkey:
+                        blinding_out_indexes.append(i)
+                        abf, vbf = engine.add_output(i, out)
+                        abfs.append(abf)
+                        vbfs.append(vbf)
+                        vals.append(out.value)
+                # get last vbf from scope
+                out = psbtv.output(blinding_out_indexes[-1])
+                if (None in vals or None in abfs or None in vbfs or None in in_tags):
+                    blinding_seed = None
+                else:
+                    vbfs[-1] = secp256k1.pedersen_blind_generator_blind_sum(vals, abfs, vbfs, psbtv.num_inputs)
+                    # sanity check
+                    assert len(abfs) == psbtv.num_inputs + len(blinding_out_indexes)
+                    assert all([len(a)==32 for a in abfs])
+                    assert all([len(a)==32 for a in vbfs])
+
+            if blinding_seed:
+                # all generators and commitments are computed before writing outputs
+                engine.prepare(abfs, vbfs, psbtv.num_inputs)
+            elif engine:
+                engine.close()
+                engine = None
+            # parse outputs and blind if necessary
             for i in range(psbtv.num_outputs):
+                if not blinding_seed:
+                    gc.collect()
+                progress = (psbtv.num_inputs + i) / (psbtv.num_inputs + psbtv.num_outputs)
+                self.show_loader(title="Parsing output %d..." % i, progress=progress)
                 out = psbtv.output(i)
-                if out.blinding_pubkey:
-                    blinding_out_indexes.append(i)
-                    abf = hashes.tagged_hash("liquid/abf", txseed+i.to_bytes(4,'little'))
-                    vbf = hashes.tagged_hash("liquid/vbf", txseed+i.to_bytes(4,'little'))
-                    abfs.append(abf)
-                    vbfs.append(vbf)
-                    vals.append(out.value)
-            # get last vbf from scope
-            out = psbtv.output(blinding_out_indexes[-1])
-            if (None in vals or None in abfs or None in vbfs or None in in_tags):
-                blinding_seed = None
-            else:
-                vbfs[-1] = secp256k1.pedersen_blind_generator_blind_sum(vals, abfs, vbfs, psbtv.num_inputs)
-                # sanity check
-                assert len(abfs) == psbtv.num_inputs + len(blinding_out_indexes)
-                assert all([len(a)==32 for a in abfs])
-                assert all([len(a)==32 for a in vbfs])
-
-        memptr, memlen = get_preallocated_ram()
-        # parse outputs and blind if necessary
-        if blinding_seed:
-            in_tags = b"".join(in_tags)
-        for i in range(psbtv.num_outputs):
-            gc.collect()
-            self.show_loader(title="Parsing output %d..." % i)
-            out = psbtv.output(i)
-            metaout = meta["outputs"][i]
-            # calculate commitments
-            if blinding_seed and out.blinding_pubkey:
-                # index of this output in the abfs, vbfs and vals
-                list_idx = psbtv.num_inputs + blinding_out_indexes.index(i)
-                self.show_loader(title="Generating asset commtiment %d..." % i)
-                # asset commitment
-                out.asset_blinding_factor = abfs[list_idx]
-                gen = secp256k1.generator_generate_blinded(out.asset, out.asset_blinding_factor)
-                out.asset_commitment = secp256k1.generator_serialize(gen)
-                self.show_loader(title="Generating value commtiment %d..." % i)
-                # value commitment
-                out.value_blinding_factor = vbfs[list_idx]
-                value_commitment = secp256k1.pedersen_commit(out.value_blinding_factor, out.value, gen)
-                out.value_commitment = secp256k1.pedersen_commitment_serialize(value_commitment)
-
-                # self.show_loader(title="Generating surjection proof %d..." % i)
-
-                # # surjection proof
-                # proof_seed = hashes.tagged_hash("liquid/surjection_proof", txseed+i.to_bytes(4,'little'))
-                # plen, in_idx = secp256k1.surjectionproof_initialize_preallocated(memptr, memlen, in_tags, out.asset, proof_seed)
-                # # proof, in_idx = secp256k1.surjectionproof_initialize(in_tags, out.asset, proof_seed)
-                # secp256k1.surjectionproof_generate(memptr, in_idx, in_gens, gen, abfs[in_idx], out.asset_blinding_factor)
-                # surjection_proof = secp256k1.surjectionproof_serialize(memptr)
-                # # del proof
-
-                # # write surjection proof
-                # ser_string(fout, b'\xfc\x04pset\x05')
-                # ser_string(fout, surjection_proof)
-                # # del surjection_proof
-
-                self.show_loader(title="Generating range proof %d..." % i)
-                # generate range proof
-                rangeproof_nonce = hashes.tagged_hash("liquid/range_proof", txseed+i.to_bytes(4,'little'))
-                pub = secp256k1.ec_pubkey_parse(out.blinding_pubkey)
-                out.ecdh_pubkey = ec.PrivateKey(rangeproof_nonce).sec()
-                secp256k1.ec_pubkey_tweak_mul(pub, rangeproof_nonce)
-                sec = secp256k1.ec_pubkey_serialize(pub)
-                ecdh_nonce = hashes.double_sha256(sec)
-                # proprietary field that stores extra message for recepient
-                extra_message=out.unknown.get(b"\xfc\x07specter\x01", b"")
-                msg = out.asset[-32:] + out.asset_blinding_factor + extra_message
-                # write to temp file to get length first
-                with open(self.tempdir+"/rangeproof_out", "wb") as frp:
-                    rplen = secp256k1.rangeproof_sign_to(
-                        frp, memptr, memlen,
-                        ecdh_nonce, out.value, secp256k1.pedersen_commitment_parse(out.value_commitment),
-                        out.value_blinding_factor, msg,
-                        out.script_pubkey.data, secp256k1.generator_parse(out.asset_commitment)
-                    )
-                # write to fout rangeproof field
-                with open(self.tempdir+"/rangeproof_out", "rb") as frp:
-                    ser_string(fout, b'\xfc\x04pset\x04')
-                    fout.write(compact.to_bytes(rplen))
-                    read_write(frp, fout, rplen)
-
-            rangeproof_offset = None
-            # we only need to verify rangeproof if we didn't generate it ourselves
-            if not blinding_seed:
-                self.show_loader(title="Verifying output %d..." % i)
-                # find rangeproof and surjection proof
-                # rangeproof
-                off = psbtv.seek_to_scope(psbtv.num_inputs+i)
+                metaout = meta["outputs"][i]
+                if engine and engine.is_blinded(i):
+                    self.show_loader(title="Generating range proof %d..." % i, progress=progress)
+                    engine.blind(i, out)
+                    engine.write_rangeproof(fout, i, out)
+
+                rangeproof_offset = None
+                # we only need to verify rangeproof if we didn't generate it ourselves
+                if not blinding_seed:
+                    self.show_loader(title="Verifying output %d..." % i, progress=progress)
+                    # find rangeproof and surjection proof
+                    # rangeproof
+                    scope = psbtv.num_inputs+i
+                    off = index.scope_offset(scope)
+                    # find offset of the rangeproof if it exists
+                    rangeproof_offset = self._copy_kv(fout, index, scope, b'\xfc\x04pset\x04')
+                    if rangeproof_offset is None:
+                        # alternative key definition (psetv0)
+                        rangeproof_offset = self._copy_kv(fout, index, scope, b'\xfc\x08elements\x04')
+                    if rangeproof_offset is not None:
+                        rangeproof_offset += off
+
+                surj_proof_offset = None
+                # surjection proof
+                scope = psbtv.num_inputs+i
+                off = index.scope_offset(scope)
                 # find offset of the rangeproof if it exists
-                rangeproof_offset = self._copy_kv(fout, psbtv, b'\xfc\x04pset\x04')
-                if rangeproof_offset is None:
-                    psbtv.seek_to_scope(psbtv.num_inputs+i)
+                surj_proof_offset = self._copy_kv(fout, index, scope, b'\xfc\x04pset\x05')
+                if surj_proof_offset is None:
                     # alternative key definition (psetv0)
-                    rangeproof_offset = self._copy_kv(fout, psbtv, b'\xfc\x08elements\x04')
-                if rangeproof_offset is not None:
-                    rangeproof_offset += off
+                    surj_proof_offset = self._copy_kv(fout, index, scope, b'\xfc\x08elements\x05')
+                if surj_proof_offset is not None:
+                    surj_proof_offset += off
 
-            surj_proof_offset = None
-            # surjection proof
-            off = psbtv.seek_to_scope(psbtv.num_inputs+i)
-            # find offset of the rangeproof if it exists
-            surj_proof_offset = self._copy_kv(fout, psbtv, b'\xfc\x04pset\x05')
-            if surj_proof_offset is None:
-                psbtv.seek_to_scope(psbtv.num_inputs+i)
-                # alternative key definition (psetv0)
-                surj_proof_offset = self._copy_kv(fout, psbtv, b'\xfc\x08elements\x05')
-            if surj_proof_offset is not None:
-                surj_proof_offset += off
-
-            wallet = None
-            for w in wallets:
                 # pass rangeproof offset if it's in the scope
-                if w and w.fill_scope(out, fingerprint,
+                wallet = self.find_scope_wallet(out, fingerprint, wallets,
                                 stream=psbtv.stream,
                                 rangeproof_offset=rangeproof_offset,
-                ):
-                    wallet = w
-                    break
-            if wallet is None:
-                # find wallet and append it to wallets
-                for w in self.wallets:
-                    # pass rangeproof offset if it's in the scope
-                    if w.fill_scope(out, fingerprint,
-                                    stream=psbtv.stream,
-                                    rangeproof_offset=rangeproof_offset,
-                    ):
-                        wallet = w
-                        break
-            # if we didn't blind it ourselves
-            if not blinding_seed:
-                try:
-                    out.verify()
-                except:
-                    raise WalletError("Commitments in output %d are wrong" % i)
-
-            # Get values (and assets) and store in metadata and wallets dict
-            asset = out.asset or out.asset_commitment
-            value = out.value or out.value_commitment
-            # blinded assets are 33-bytes long, unblinded - 32
-            if not (asset and value) or not (len(asset) == 32 and isinstance(value, int)):
-                asset = None
-                value = -1
-            metaout.update({
-                "change": (wallet is not None and len(wallets) == 1 and wallet in wallets),
-                "value": value,
-                "address": self.get_address(out),
-                "asset": self.asset_label(asset),
-            })
-            if wallet:
-                metaout["label"] = wallet.name
-                res = wallet.get_derivation(out.bip32_derivations)
-                if res:
-                    idx, branch_idx = res
-                    branch_txt = ""
-                    if branch_idx == 1:
-                        "change "
-                    elif branch_idx > 1:
-                        "branch %d " % branch_idx
-                    metaout["label"] = "%s %s#%d" % (wallet.name, branch_txt, idx)
-                    if wallet in wallets:
-                        allowed_idx = wallets[wallet]["gaps"][branch_idx]
-                    else:
-                        allowed_idx = wallet.gaps[branch_idx]
-                    if allowed_idx <= idx:
-                        metaout["warning"] = "Derivation index is by %d larger than last known used index %d!" % (idx-allowed_idx+wallet.GAP_LIMIT, allowed_idx-wallet.GAP_LIMIT)
-                if wallet.is_watchonly:
-                    metaout["warning"] = "Watch-only wallet!"
-            if asset and asset not in self.assets:
-                metaout.update({"raw_asset": asset})
-            out.write_to(fout, skip_separator=True, version=psbtv.version)
-            # write rangeproofs and surjection proofs
-            # separator
-            fout.write(b"\x00")
-
+                                rewind_cache=rewind_cache,
+                )
+                # if we didn't blind it ourselves
+                if not blinding_seed:
+                    try:
+                        out.verify()
+                    except:
+                        raise WalletError("Commitments in output %d are wrong" % i)
+
+                # Get values (and assets) and store in metadata and wallets dict
+                asset = out.asset or out.asset_commitment
+                value = out.value or out.value_commitment
+                # blinded assets are 33-bytes long, unblinded - 32
+                if not (asset and value) or not (len(asset) == 32 and isinstance(value, int)):
+                    asset = None
+                    value = -1
+                metaout.update({
+                    "change": (wallet is not None and len(wallets) == 1 and wallet in wallets),
+                    "value": value,
+                    "address": self.get_address(out),
+                    "asset": self.asset_label(asset),
+                })
+                if wallet:
+                    metaout["label"] = wallet.name
+                    res = wallet.get_derivation(out.bip32_derivations)
+                    if res:
+                        idx, branch_idx = res
+                        branch_txt = ""
+                        if branch_idx == 1:
+                            "change "
+                        elif branch_idx > 1:
+                            "branch %d " % branch_idx
+                        metaout["label"] = "%s %s#%d" % (wallet.name, branch_txt, idx)
+                        if wallet in wallets:
+                            allowed_idx = wallets[wallet]["gaps"][branch_idx]
+                        else:
+                            allowed_idx = wallet.gaps[branch_idx]
+                        if allowed_idx <= idx:
+                            metaout["warning"] = "Derivation index is by %d larger than last known used index %d!" % (idx-allowed_idx+wallet.GAP_LIMIT, allowed_idx-wallet.GAP_LIMIT)
+                    if wallet.is_watchonly:
+                        metaout["warning"] = "Watch-only wallet!"
+                    if plan is not None and wallet in wallets:
+                        plan.add_derivation(wallet, wallet.get_derivation(out.bip32_derivations))
+                if asset and not self.is_known_asset(asset):
+                    metaout.update({"raw_asset": asset})
+                out.write_to(fout, skip_separator=True, version=psbtv.version)
+                # write rangeproofs and surjection proofs
+                # separator
+                fout.write(b"\x00")
+        finally:
+            # drops blinding data and scratch buffers on errors too
+            if engine:
+                engine.close()
+        self.sign_plan = plan
         return wallets, meta
 
 
@@ -583,17 +507,38 @@ class LWalletManager(WalletManager):
         # passing "BTC" shouldn't break things
         if isinstance(asset, str):
             return asset
-        if asset in self.assets:
-            return self.assets[asset]
+        label = self.get_asset(asset)
+        if label is not None:
+            return label
         h = hexlify(bytes(reversed(asset))).decode()
         # hex repr of the asset
         return "L-"+h[:4]+"..."+h[-4:]
 
+    def get_asset(self, asset):
+        """
+        Returns label of the asset or None if it's unknown.
+        Only assets used in the current transaction are kept in memory.
+        """
+        if asset is None:
+            return None
+        if asset not in self.assets:
+            self.assets[asset] = self.asset_index.get(asset) if self.asset_index else None
+        return self.assets[asset]
+
+    def is_known_asset(self, asset):
+        return self.get_asset(asset) is not None
+
+    def add_asset(self, asset, label, sync=True):
+        self.asset_index.add(asset, label, sync=sync)
+        self.assets[asset] = label
+
     def assets_json(self):
         assets = {}
         # no support for bytes...
-        for asset in self.assets:
-            assets[hexlify(bytes(reversed(asset))).decode()] = self.assets[asset]
+        for asset, label in self.known_assets.items():
+            assets[hexlify(bytes(reversed(asset))).decode()] = label
+        for asset, label in self.asset_index.items():
+            assets[hexlify(bytes(reversed(asset))).decode()] = label
         return json.dumps(assets)
 
     @property
@@ -602,25 +547,33 @@ class LWalletManager(WalletManager):
 
     @property
     def assets_file(self):
+        # legacy json file, migrated to the index on load
         return self.assets_path + "/assets_" + self.network
 
-    def save_assets(self):
-        platform.maybe_mkdir(self.assets_path)
-        assets = self.assets_json()
-        self.keystore.save_aead(self.assets_file, plaintext=assets.encode(), key=self.keystore.userkey)
-
-    def load_assets(self):
-        self.assets = {}
-        # known Liquid assets
+    @property
+    def known_assets(self):
+        # well-known Liquid assets
         if self.network == "liquidv1":
-            self.assets.update({
+            return {
                 bytes(reversed(unhexlify("6f0279e9ed041c3d710a9f57d0c02928416460c4b722ae3457a11eec381c526d"))): "LBTC",
                 bytes(reversed(unhexlify("ce091c998b83c78bb71a632313ba3760f1763d9cfcffae02258ffa9865a37bd2"))): "USDt",
-            })
+            }
+        return {}
+
+    def reset_assets(self):
+        """Drops labels cached for the previous transaction"""
+        self.assets = self.known_assets
+
+    def load_assets(self):
+        self.reset_assets()
         platform.maybe_mkdir(self.assets_path)
+        self.asset_index = AssetIndex(self.assets_path + "/assets_" + self.network, self.keystore.userkey)
+        # move labels from the json file to the index
         if platform.file_exists(self.assets_file):
             _, assets = self.keystore.load_aead(self.assets_file, key=self.keystore.userkey)
             assets = json.loads(assets.decode())
             # no support for bytes...
-            for asset in assets:
-                self.assets[bytes(reversed(unhexlify(asset)))] = assets[asset]
+            self.asset_index.update({
+                bytes(reversed(unhexlify(asset))): assets[asset] for asset in assets
+            })
+            os.remove(self.assets_file)
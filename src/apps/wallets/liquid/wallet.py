@@ -1,5 +1,5 @@
 from ..wallet import *
-from platform import maybe_mkdir, delete_recursively, get_preallocated_ram
+from platform import maybe_mkdir, delete_recursively, acquire_preallocated_ram, release_preallocated_ram
 from embit import ec, hashes, script, compact
 from embit.liquid.networks import NETWORKS
 from embit.liquid.descriptor import LDescriptor
@@ -16,9 +16,11 @@ class LWallet(Wallet):
     DescriptorClass = LDescriptor
     Networks = NETWORKS
 
-    def fill_scope(self, scope, fingerprint, stream=None, rangeproof_offset=None, surj_proof_offset=None):
+    def fill_scope(self, scope, fingerprint, stream=None, rangeproof_offset=None, surj_proof_offset=None, rewind_cache=None):
         """
         Fills derivation paths in inputs.
+        Ownership is checked by script_pubkey before any rangeproof rewind.
+        rewind_cache is an optional per-transaction dict of rewind results.
         Returns:
         - True if all went well
         - False if wallet doesn't own input
@@ -29,19 +31,18 @@ class LWallet(Wallet):
         if der is None:
             return False
         idx, branch_idx = der
-        desc = self.descriptor.derive(idx, branch_index=branch_idx)
+        desc = self.derive(idx, branch_idx)
         # find keys with our fingerprint
-        for key in desc.keys:
-            if key.fingerprint == fingerprint:
-                pub = key.get_public_key()
+        for fp, pub, derivation in self.derived_keys(idx, branch_idx):
+            if fp == fingerprint:
                 # fill our derivations
                 scope.bip32_derivations[pub] = DerivationPath(
-                    fingerprint, key.derivation
+                    fingerprint, derivation
                 )
         # if liquid - unblind / blind etc
         if desc.is_blinded:
             try:
-                if not self.fill_pset_scope(scope, desc, stream, rangeproof_offset, surj_proof_offset):
+                if not self.fill_pset_scope(scope, desc, stream, rangeproof_offset, surj_proof_offset, rewind_cache):
                     return False
             except RewindError as e:
                 print(e)
@@ -51,21 +52,40 @@ class LWallet(Wallet):
         scope.redeem_script = desc.redeem_script()
         return True
 
-    def fill_pset_scope(self, scope, desc, stream=None, rangeproof_offset=None, surj_proof_offset=None):
+    def fill_pset_scope(self, scope, desc, stream=None, rangeproof_offset=None, surj_proof_offset=None, rewind_cache=None):
         # if we don't have a rangeproof offset - nothing we can really do
         if rangeproof_offset is None:
             return True
-        # pointer and length of preallocated memory for rangeproof rewind
-        memptr, memlen = get_preallocated_ram()
         # for inputs we check if rangeproof is there
         # check if we actually need to rewind
         if None not in [scope.asset, scope.value, scope.asset_blinding_factor, scope.value_blinding_factor]:
             # verify that asset and value blinding factors lead to value and asset commitments
             return True
-        stream.seek(rangeproof_offset)
-        l = compact.read_from(stream)
         vout = scope.utxo if isinstance(scope, LInputScope) else scope.blinded_vout
         blinding_key = desc.blinding_key.get_blinding_key(vout.script_pubkey).secret
+        # offset of the rangeproof identifies the scope in the transaction
+        cache_key = (rangeproof_offset, blinding_key)
+        if rewind_cache is not None and cache_key in rewind_cache:
+            res = rewind_cache[cache_key]
+        else:
+            try:
+                res = self.rewind(stream, rangeproof_offset, vout, blinding_key)
+            except RewindError as e:
+                res = e
+            if rewind_cache is not None:
+                rewind_cache[cache_key] = res
+        if isinstance(res, RewindError):
+            raise res
+        scope.value, scope.value_blinding_factor, scope.asset, scope.asset_blinding_factor = res
+        return True
+
+    def rewind(self, stream, rangeproof_offset, vout, blinding_key):
+        """
+        Rewinds rangeproof at rangeproof_offset in the stream.
+        Returns a tuple (value, value blinding factor, asset, asset blinding factor).
+        """
+        stream.seek(rangeproof_offset)
+        l = compact.read_from(stream)
         # get the nonce for unblinding
         pub = secp256k1.ec_pubkey_parse(vout.ecdh_pubkey)
         secp256k1.ec_pubkey_tweak_mul(pub, blinding_key)
@@ -73,17 +93,19 @@ class LWallet(Wallet):
         nonce = hashlib.sha256(hashlib.sha256(sec).digest()).digest()
         commit = secp256k1.pedersen_commitment_parse(vout.value)
         gen = secp256k1.generator_parse(vout.asset)
+        # pointer and length of preallocated memory for rangeproof rewind
+        mem = acquire_preallocated_ram(self)
+        if mem is None:
+            raise WalletError("Preallocated memory is in use, try again later")
         try:
             value, vbf, msg, _, _ = secp256k1.rangeproof_rewind_from(
-                stream, l, memptr, memlen,
+                stream, l, mem[0], mem[1],
                 nonce, commit, vout.script_pubkey.data, gen
             )
         except ValueError as e:
             raise RewindError(str(e))
+        finally:
+            release_preallocated_ram(self)
         asset = msg[:32]
         abf = msg[32:64]
-        scope.value = value
-        scope.value_blinding_factor = vbf
-        scope.asset = asset
-        scope.asset_blinding_factor = abf
-        return True
+        return value, vbf, asset, abf
@@ -11,12 +11,16 @@ from embit.psbtview import PSBTView, read_write, PSBTError
 from embit.networks import NETWORKS
 from embit.transaction import SIGHASH
 from .wallet import WalletError, Wallet
+from .sighash import SighashContext
+from .scopeindex import ScopeIndex
 from .commands import DELETE, EDIT
 from io import BytesIO
 from bcur import bcur_decode_stream
-from helpers import a2b_base64_stream, b2a_base64_stream
+from helpers import a2b_base64_stream, b2a_base64_stream, ReadCounter
 import gc
 import json
+import profiler
+import ramstore
 
 SIGN_PSBT = 0x01
 ADD_WALLET = 0x02
@@ -43,6 +47,46 @@ SIGHASH_NAMES = {
 for sh in list(SIGHASH_NAMES):
     SIGHASH_NAMES[sh | SIGHASH.ANYONECANPAY] = SIGHASH_NAMES[sh] + " | ANYONECANPAY"
 
+class SignPlan:
+    """
+    Per-transaction state collected during preprocessing
+    so signing doesn't need extra passes over the PSBT:
+    gaps are updated without scanning the psbt for every wallet
+    and the keystore signs without parsing inputs one more time.
+    """
+
+    def __init__(self, num_inputs):
+        # None if the input has no derivations with our fingerprint,
+        # otherwise (derivations, sighash type, is taproot)
+        self.inputs = [None for i in range(num_inputs)]
+        # wallet: max derivation index per branch
+        self.idxs = {}
+
+    def add_input(self, i, inp, wallet, keystore):
+        """Collects signing data of the filled input i"""
+        ders = keystore.input_derivations(inp)
+        if ders:
+            self.inputs[i] = (ders, inp.sighash_type, bool(inp.taproot_bip32_derivations))
+        if wallet:
+            self.add_derivation(wallet, wallet.get_derivation(inp.bip32_derivations, inp.taproot_bip32_derivations))
+
+    def is_mine(self, i):
+        return self.inputs[i] is not None
+
+    def add_derivation(self, wallet, der):
+        if der is None:
+            return
+        idx, branch_idx = der
+        if wallet not in self.idxs:
+            self.idxs[wallet] = [None for g in wallet.gaps]
+        idxs = self.idxs[wallet]
+        if idxs[branch_idx] is None or idxs[branch_idx] < idx:
+            idxs[branch_idx] = idx
+
+    def used_idxs(self, wallet):
+        return self.idxs.get(wallet)
+
+
 class WalletManager(BaseApp):
     """
     WalletManager class manages your wallets.
@@ -62,12 +106,33 @@ class WalletManager(BaseApp):
     # supported networks
     Networks = NETWORKS
     DEFAULT_SIGHASH = SIGHASH.ALL
+    # reuse preprocessing state when signing, see sign_psbtview()
+    PIPELINED_SIGNING = getattr(platform.config, "PIPELINED_SIGNING", False)
+    # encrypted file with wallet headers for fast loading
+    REGISTRY = "registry"
+    REGISTRY_VERSION = 2
 
     def __init__(self, path):
         self.root_path = path
         platform.maybe_mkdir(path)
         self.path = None
+        # last written registry plaintext
+        self._registry_data = None
         self.wallets = []
+        # (fingerprint, derivation prefix) -> [wallets], see index_wallets()
+        self.wallet_index = {}
+        # fingerprint -> set of prefix lengths used in the index
+        self.prefix_lengths = {}
+        # wallets with keys without origin info, always checked
+        self.unindexed_wallets = []
+        # number of fill_scope calls saved by the index
+        # compared to trying every stored wallet
+        self.fill_scope_avoided = 0
+        self.pipelined_signing = self.PIPELINED_SIGNING
+        # SignPlan of the last preprocessed transaction
+        self.sign_plan = None
+        # bytes read from the PSBT during the last signing
+        self.sign_bytes_read = 0
 
     def init(self, keystore, network, *args, **kwargs):
         """Loads or creates default wallets for new keystore or network"""
@@ -83,10 +148,13 @@ class WalletManager(BaseApp):
         path += "/" + network
         platform.maybe_mkdir(path)
         self.path = path
+        self._registry_data = None
         self.wallets = self.load_wallets()
         if self.wallets is None or len(self.wallets) == 0:
             w = self.create_default_wallet(path=self.path + "/0")
             self.wallets = [w]
+            self.index_wallets(self.wallets)
+            self.save_registry()
 
     def get_address(self, psbtout):
         """Helper function to get an address for every output"""
@@ -132,7 +200,7 @@ class WalletManager(BaseApp):
                 name = await show_screen(scr)
                 if name is not None and name != w.name and name != "":
                     w.name = name
-                    w.save(self.keystore)
+                    self.save_wallet(w)
             return True
 
     def can_process(self, stream):
@@ -190,7 +258,7 @@ class WalletManager(BaseApp):
         return None, None
 
     async def process_host_command(self, stream, show_screen):
-        platform.delete_recursively(self.tempdir)
+        ramstore.delete_recursively(self.tempdir)
         cmd, stream = self.parse_stream(stream)
         if cmd == SIGN_PSBT:
             magic = stream.read(len(self.PSBTViewClass.MAGIC))
@@ -219,10 +287,10 @@ class WalletManager(BaseApp):
                 stream.seek(pos-len(d)+1, 1)
             else:
                 stream.seek(-len(d), 1)
-            with open(self.tempdir+"/raw", "wb") as f:
+            with ramstore.open(self.tempdir+"/raw", "wb") as f:
                 bcur_decode_stream(stream, f)
             gc.collect()
-            with open(self.tempdir+"/raw", "rb") as f:
+            with ramstore.open(self.tempdir+"/raw", "rb") as f:
                 res = await self.sign_psbt(f, show_screen, encoding=RAW_STREAM)
             if res is not None:
                 # encoding will be handled by the host class
@@ -279,14 +347,14 @@ class WalletManager(BaseApp):
 
     async def sign_psbt(self, stream, show_screen, encoding=BASE64_STREAM):
         if encoding == BASE64_STREAM:
-            with open(self.tempdir+"/raw", "wb") as f:
+            with ramstore.open(self.tempdir+"/raw", "wb") as f, profiler.span("psbt.decode"):
                 # read in chunks, write to ram file
                 a2b_base64_stream(stream, f)
-            with open(self.tempdir+"/raw", "rb") as f:
+            with ramstore.open(self.tempdir+"/raw", "rb") as f:
                 res = await self.sign_psbt(f, show_screen, encoding=RAW_STREAM)
             if res:
-                with open(self.tempdir+"/signed_b64", "wb") as fout:
-                    with open(res, "rb") as fin:
+                with ramstore.open(self.tempdir+"/signed_b64", "wb") as fout, profiler.span("psbt.encode"):
+                    with ramstore.open(res, "rb") as fin:
                         b2a_base64_stream(fin, fout)
                 return self.tempdir+"/signed_b64"
             return
@@ -294,14 +362,16 @@ class WalletManager(BaseApp):
         # preprocess stream - parse psbt, check wallets in inputs and outputs,
         # get metadata to display, default sighash for signing,
         # fill missing metadata and store it in temp file:
-        with open(self.tempdir + "/filled_psbt", "wb") as fout:
+        with ramstore.open(self.tempdir + "/filled_psbt", "wb") as fout:
             try:
-                wallets, meta = self.preprocess_psbt(stream, fout)
+                with profiler.span("psbt.preprocess"):
+                    wallets, meta = self.preprocess_psbt(stream, fout)
             except PSBTError as e:
                 raise WalletError("Invalid PSBT:\n\n%s" % e)
 
         # now we can work with copletely filled psbt:
-        with open(self.tempdir + "/filled_psbt", "rb") as f:
+        with ramstore.open(self.tempdir + "/filled_psbt", "rb") as f:
+            f = ReadCounter(f)
             psbtv = self.PSBTViewClass.view(f, compress=True)
 
             # ask user for everything, if None is returned - user cancelled at some point
@@ -313,8 +383,12 @@ class WalletManager(BaseApp):
             gc.collect()
             # sign transaction if the user confirmed
             self.show_loader(title="Signing transaction...")
-            with open(self.tempdir+"/signed_raw", "wb") as f:
-                sig_count = self.sign_psbtview(psbtv, f, wallets, **options)
+            f.count = 0
+            with ramstore.open(self.tempdir+"/signed_raw", "wb") as fout, profiler.span("psbt.sign"):
+                sig_count = self.sign_psbtview(psbtv, fout, wallets, **options)
+            self.sign_bytes_read = f.count
+            # compare between PIPELINED_SIGNING modes in the profiler dump
+            profiler.count_io("psbt.sign", read=f.count)
             return self.tempdir+"/signed_raw"
 
     async def confirm_transaction(self, wallets, meta, show_screen):
@@ -484,22 +558,191 @@ class WalletManager(BaseApp):
         addr, _ = w.get_address(idx, self.network, branch_idx)
         return addr
 
+    def get_wallet_ids(self):
+        # Every wallet is stored in a numeric folder
+        return sorted(
+            [
+                int(f[0])
+                for f in os.ilistdir(self.path)
+                if f[0].isdigit() and f[1] == 0x4000
+            ]
+        )
+
     def load_wallets(self):
-        """Loads all wallets from path"""
+        """
+        Loads all wallets from path.
+        If the registry is up to date wallets are created from their headers
+        and descriptors are parsed lazily on first use.
+        """
         try:
             platform.maybe_mkdir(self.path)
-            # Get ids of the wallets.
-            # Every wallet is stored in a numeric folder
-            wallet_ids = sorted(
-                [
-                    int(f[0])
-                    for f in os.ilistdir(self.path)
-                    if f[0].isdigit() and f[1] == 0x4000
-                ]
-            )
-            return [self.load_wallet(self.path + ("/%d" % wid)) for wid in wallet_ids]
+            wallet_ids = self.get_wallet_ids()
+            wallets = self.load_registry(wallet_ids)
+            rebuild = wallets is None
+            if rebuild:
+                wallets = [self.load_wallet(self.path + ("/%d" % wid)) for wid in wallet_ids]
         except:
-            return []
+            wallets = []
+            rebuild = False
+        # wallets are loaded fine even if we can't write the registry,
+        # it will be rebuilt on the next load
+        if rebuild:
+            try:
+                self.save_registry(wallets)
+            except:
+                pass
+        self.index_wallets(wallets)
+        return wallets
+
+    @property
+    def registry_path(self):
+        return self.path + "/" + self.REGISTRY
+
+    def load_registry(self, wallet_ids):
+        """
+        Returns wallets from the registry file
+        or None if registry is missing or doesn't match wallet folders.
+        """
+        try:
+            _, data = self.keystore.load_aead(self.registry_path)
+            obj = json.loads(data.decode())
+        except:
+            return None
+        if obj.get("version") != self.REGISTRY_VERSION:
+            return None
+        headers = obj.get("wallets", {})
+        if sorted([int(wid) for wid in headers]) != wallet_ids:
+            return None
+        return [
+            self.WalletClass.from_header(self.path + ("/%d" % wid), headers[str(wid)], self.keystore)
+            for wid in wallet_ids
+        ]
+
+    def save_registry(self, wallets=None, sync=True):
+        """
+        Writes compact headers of all wallets to the encrypted registry.
+        Skips the write if headers didn't change since last save.
+        """
+        if wallets is None:
+            wallets = self.wallets
+        headers = {}
+        for w in wallets:
+            if w.path is None:
+                continue
+            headers[w.path.split("/")[-1]] = w.get_header()
+        obj = {"version": self.REGISTRY_VERSION, "wallets": headers}
+        data = json.dumps(obj).encode()
+        if data == self._registry_data:
+            return False
+        self.keystore.save_aead(self.registry_path, plaintext=data, sync=sync)
+        self._registry_data = data
+        return True
+
+    def save_wallets(self, wallets=None):
+        """
+        Saves wallets with unsaved changes and the registry
+        with a single flash sync at the end.
+        Returns number of wallets written.
+        """
+        if wallets is None:
+            wallets = self.wallets
+        count = 0
+        for w in wallets:
+            if w is not None and w.save(self.keystore, sync=False):
+                count += 1
+        if self.save_registry(sync=False) or count > 0:
+            platform.sync()
+        return count
+
+    def save_wallet(self, w):
+        """Saves the wallet and updates its header in the registry"""
+        self.save_wallets([w])
+
+    def index_wallets(self, wallets):
+        """
+        Builds a lookup table (fingerprint, derivation prefix) -> wallets
+        from the key origins of every wallet,
+        so psbt scopes resolve to their wallet without trying all of them.
+        """
+        self.wallet_index = {}
+        self.prefix_lengths = {}
+        self.unindexed_wallets = []
+        for w in wallets:
+            self._index_wallet(w)
+
+    def _index_wallet(self, w):
+        # key origins are available from the registry header
+        # so indexing doesn't parse the descriptor
+        for origin in w.key_origins:
+            # keys without origin can't be matched by derivation,
+            # wallet will be checked for every scope
+            if origin is None:
+                if w not in self.unindexed_wallets:
+                    self.unindexed_wallets.append(w)
+                continue
+            fingerprint, prefix = origin
+            arr = self.wallet_index.get((fingerprint, prefix), [])
+            if w not in arr:
+                arr.append(w)
+            self.wallet_index[(fingerprint, prefix)] = arr
+            lengths = self.prefix_lengths.get(fingerprint, set())
+            lengths.add(len(prefix))
+            self.prefix_lengths[fingerprint] = lengths
+
+    def _unindex_wallet(self, w):
+        for key in list(self.wallet_index):
+            arr = self.wallet_index[key]
+            if w in arr:
+                arr.remove(w)
+            if len(arr) == 0:
+                self.wallet_index.pop(key)
+        if w in self.unindexed_wallets:
+            self.unindexed_wallets.remove(w)
+
+    def get_scope_wallets(self, scope):
+        """
+        Returns wallets that may own the scope according to the wallet index.
+        Wallets still need to be checked with fill_scope.
+        """
+        derivations = list(scope.bip32_derivations.values())
+        derivations += [der for _, der in scope.taproot_bip32_derivations.values()]
+        return self.get_derivation_wallets(derivations)
+
+    def get_derivation_wallets(self, derivations):
+        """Returns wallets that may have keys with these derivation paths"""
+        res = []
+        for der in derivations:
+            for l in self.prefix_lengths.get(der.fingerprint, []):
+                if l > len(der.derivation):
+                    continue
+                for w in self.wallet_index.get((der.fingerprint, tuple(der.derivation[:l])), []):
+                    if w not in res:
+                        res.append(w)
+        for w in self.unindexed_wallets:
+            if w not in res:
+                res.append(w)
+        return res
+
+    def find_scope_wallet(self, scope, fingerprint, wallets=[], **kwargs):
+        """
+        Finds a wallet owning the scope and fills scope data.
+        Wallets already detected in the transaction are tried first
+        as in most common case all inputs are owned by the same wallet.
+        Extra kwargs are passed to the fill_scope method of the wallet.
+        Returns None if no wallet owns the scope.
+        """
+        candidates = self.get_scope_wallets(scope)
+        candidates = [w for w in wallets if w in candidates] + [w for w in candidates if w not in wallets]
+        tried = 0
+        found = None
+        with profiler.span("wallets.match"):
+            for w in candidates:
+                tried += 1
+                if w.fill_scope(scope, fingerprint, **kwargs):
+                    found = w
+                    break
+        self.fill_scope_avoided += max(len(self.wallets) - tried, 0)
+        return found
 
     def load_wallet(self, path):
         """Loads a wallet with particular id"""
@@ -522,7 +765,7 @@ class WalletManager(BaseApp):
         )
         w = self.WalletClass.parse("Default&"+desc, path)
         # pass keystore to encrypt data
-        w.save(self.keystore)
+        w.save(self.keystore, sync=False)
         platform.sync()
         return w
 
@@ -531,7 +774,9 @@ class WalletManager(BaseApp):
             w = self.WalletClass.parse(desc)
         except Exception as e:
             raise WalletError("Can't parse descriptor\n\n%s" % str(e))
-        if str(w.descriptor) in [str(ww.descriptor) for ww in self.wallets]:
+        # compare fingerprints first to avoid parsing all stored wallets
+        fingerprint = w.fingerprint
+        if str(w.descriptor) in [str(ww.descriptor) for ww in self.wallets if ww.fingerprint == fingerprint]:
             raise WalletError("Wallet with this descriptor already exists")
         # check that xpubs and tpubs are not mixed in the same descriptor:
         if not w.check_network(self.Networks[self.network]):
@@ -540,31 +785,38 @@ class WalletManager(BaseApp):
 
     def add_wallet(self, w):
         self.wallets.append(w)
-        wallet_ids = sorted(
-            [
-                int(f[0])
-                for f in os.ilistdir(self.path)
-                if f[0].isdigit() and f[1] == 0x4000
-            ]
-        )
+        wallet_ids = self.get_wallet_ids()
         # get wallet id
         wid = (max(wallet_ids) + 1) if wallet_ids else 0
         newpath = self.path + ("/%d" % wid)
         platform.maybe_mkdir(newpath)
-        w.save(self.keystore, path=newpath)
+        w.save(self.keystore, path=newpath, sync=False)
+        self.save_registry(sync=False)
+        platform.sync()
+        self._index_wallet(w)
 
     def delete_wallet(self, w):
         if w not in self.wallets:
             raise WalletError("Wallet not found")
         self.wallets.pop(self.wallets.index(w))
+        self._unindex_wallet(w)
         w.wipe()
+        self.save_registry()
+
+    def address_matches(self, derived, addr):
+        return derived == addr
 
     def find_wallet_from_address(self, addr: str, paths=None, index=None):
+        # recently displayed addresses don't need derivation
+        for w in self.wallets:
+            res = w.find_cached_address(addr, self.network, self.address_matches)
+            if res is not None and (index is None or res == (index, 0)):
+                return w, res
         if index is not None:
             for w in self.wallets:
                 a, _ = w.get_address(index, self.network)
-                if a == addr:
-                    return w, (0, index)
+                if self.address_matches(a, addr):
+                    return w, (index, 0)
         if paths is not None:
             # we can detect the wallet from just one path
             p = paths[0]
@@ -575,12 +827,12 @@ class WalletManager(BaseApp):
                 fingerprint = self.keystore.fingerprint
                 derivation = bip32.parse_path(p)
             derivation_path = DerivationPath(fingerprint, derivation)
-            for w in self.wallets:
+            for w in self.get_derivation_wallets([derivation_path]):
                 der = w.descriptor.check_derivation(derivation_path)
                 if der is not None:
                     idx, branch_idx = der
                     a, _ = w.get_address(idx, self.network, branch_idx)
-                    if a == addr:
+                    if self.address_matches(a, addr):
                         return w, (idx, branch_idx)
         raise WalletError("Can't find wallet owning address %s" % addr)
 
@@ -592,20 +844,15 @@ class WalletManager(BaseApp):
                 if self.keystore.get_xpub(scope.bip32_derivations[pub].derivation).key == pub:
                     scope.bip32_derivations[pub].fingerprint = self.keystore.fingerprint
 
-    def check_signed_inputs(self, psbtv):
+    def check_signed_inputs(self, psbtv, index=None):
         """Goes through all input scopes and checks if they are already signed"""
+        if index is None:
+            index = ScopeIndex(psbtv)
         signed_inputs = 0
         for i in range(psbtv.num_inputs):
-            psbtv.seek_to_scope(i)
-            off = psbtv.seek_to_value(b"\x07", from_current=True) # final scriptsig
-            if off is not None:
+            # final scriptsig or final scriptwitness
+            if index.find(i, b"\x07") is not None or index.find(i, b"\x08") is not None:
                 signed_inputs += 1
-                continue
-            psbtv.seek_to_scope(i)
-            off = psbtv.seek_to_value(b"\x08", from_current=True) # final scriptwitness
-            if off is not None:
-                signed_inputs += 1
-                continue
         return signed_inputs
 
     def preprocess_psbt(self, stream, fout):
@@ -616,12 +863,17 @@ class WalletManager(BaseApp):
         - metadata for tx display including warnings that require user confirmation
         """
         self.show_loader(title="Parsing transaction...")
+        self.fill_scope_avoided = 0
+        self.sign_plan = None
 
         # compress = True flag will make sure large fields won't be loaded to RAM
         psbtv = self.PSBTViewClass.view(stream, compress=True)
+        plan = SignPlan(psbtv.num_inputs) if self.pipelined_signing else None
+        # offsets of all keys in all scopes
+        index = ScopeIndex(psbtv)
 
         # check if inputs are already signed
-        signed_inputs = self.check_signed_inputs(psbtv)
+        signed_inputs = self.check_signed_inputs(psbtv, index)
 
         # Write global scope first
         psbtv.stream.seek(psbtv.offset)
@@ -646,7 +898,8 @@ class WalletManager(BaseApp):
         # bip32 derivations, witness script, redeem script
         # At the end we should have the most complete PSBT / PSET possible
         for i in range(psbtv.num_inputs):
-            self.show_loader(title="Parsing input %d..." % i)
+            self.show_loader(title="Parsing input %d..." % i,
+                             progress=i / (psbtv.num_inputs + psbtv.num_outputs))
             # load input to memory, verify it (check prevtx hash)
             inp = psbtv.input(i)
             metainp = meta["inputs"][i]
@@ -659,23 +912,9 @@ class WalletManager(BaseApp):
 
             self.fill_zero_fingerprint(inp)
 
-            # Find wallets owning the inputs and fill scope data:
-            # first we check already detected wallet owns the input
-            # as in most common case all inputs are owned by the same wallet.
-            wallet = None
+            # Find wallets owning the inputs and fill scope data
+            wallet = self.find_scope_wallet(inp, fingerprint, wallets)
             gaps = None
-            for w in wallets:
-                # pass rangeproof offset if it's in the scope
-                if w and w.fill_scope(inp, fingerprint):
-                    wallet = w
-                    break
-            if wallet is None:
-                # find wallet and append it to wallets
-                for w in self.wallets:
-                    # pass rangeproof offset if it's in the scope
-                    if w.fill_scope(inp, fingerprint):
-                        wallet = w
-                        break
             if wallet:
                 gaps = [g for g in wallet.gaps] # copy
                 res = wallet.get_derivation(inp.bip32_derivations)
@@ -699,12 +938,11 @@ class WalletManager(BaseApp):
             })
             if wallet and wallet.is_watchonly:
                 metainp["label"] += " (watch-only)"
+            if plan is not None:
+                plan.add_input(i, inp, wallet, self.keystore)
             # write non_witness_utxo separately if it exists (as we use compressed psbtview)
-            non_witness_utxo_off = None
-            off = psbtv.seek_to_scope(i)
-            non_witness_utxo_off = psbtv.seek_to_value(b'\x00', from_current=True)
+            non_witness_utxo_off = index.seek_to_value(i, b'\x00')
             if non_witness_utxo_off:
-                non_witness_utxo_off += off
                 l = compact.read_from(psbtv.stream)
                 fout.write(b"\x01\x00")
                 fout.write(compact.to_bytes(l))
@@ -713,24 +951,14 @@ class WalletManager(BaseApp):
 
         # parse all outputs
         for i in range(psbtv.num_outputs):
-            self.show_loader(title="Parsing output %d..." % i)
+            self.show_loader(title="Parsing output %d..." % i,
+                             progress=(psbtv.num_inputs + i) / (psbtv.num_inputs + psbtv.num_outputs))
             out = psbtv.output(i)
             metaout = meta["outputs"][i]
 
             self.fill_zero_fingerprint(out)
 
-            wallet = None
-            for w in wallets:
-                # pass rangeproof offset if it's in the scope
-                if w and w.fill_scope(out, fingerprint):
-                    wallet = w
-                    break
-            if wallet is None:
-                # find wallet and append it to wallets
-                for w in self.wallets:
-                    if w.fill_scope(out, fingerprint):
-                        wallet = w
-                        break
+            wallet = self.find_scope_wallet(out, fingerprint, wallets)
             # Get values and store in metadata and wallets dict
             value = out.value
             fee -= value
@@ -758,41 +986,88 @@ class WalletManager(BaseApp):
                         metaout["warning"] = "Derivation index is by %d larger than last known used index %d!" % (idx-allowed_idx+wallet.GAP_LIMIT, allowed_idx-wallet.GAP_LIMIT)
                 if wallet.is_watchonly:
                     metaout["warning"] = "Watch-only wallet!"
+                if plan is not None and wallet in wallets:
+                    plan.add_derivation(wallet, wallet.get_derivation(out.bip32_derivations, out.taproot_bip32_derivations))
 
             out.write_to(fout, version=psbtv.version)
         meta["fee"] = fee
+        self.sign_plan = plan
         return wallets, meta
 
     def sign_psbtview(self, psbtv, out_stream, wallets, sighash):
+        """
+        Signs all inputs and writes signed psbt to out_stream.
+        If preprocessing collected a SignPlan (PIPELINED_SIGNING config option),
+        gaps are updated from it instead of scanning the psbt for every wallet,
+        inputs without our fingerprint are skipped and the keystore signs
+        from derivations collected in the plan without parsing inputs again.
+        Wallets with private keys still parse inputs for signing
+        and the signed psbt is written in a separate pass as usual.
+        """
+        plan = self.sign_plan
+        self.sign_plan = None
         for w in wallets:
             if w is None:
                 continue
             # update max used derivations in wallets
-            w.update_gaps(psbtv=psbtv)
-            w.save(self.keystore)
+            if plan is not None:
+                w.update_gaps(used_idxs=plan.used_idxs(w))
+            else:
+                w.update_gaps(psbtv=psbtv)
+        # only changed wallets are written, with one sync for all of them
+        self.save_wallets(wallets)
         sig_count = 0
-        with open(self.tempdir+"/sigs", "wb") as sig_stream:
-            for i in range(psbtv.num_inputs):
-                self.show_loader(title="Signing input %d of %d" % (i+1, psbtv.num_inputs))
-                inp = psbtv.input(i)
-                inp_sighash = sighash or inp.sighash_type or self.DEFAULT_SIGHASH
-                for w in wallets:
-                    if w is None:
-                        continue
-                    # sign with wallet if it has private keys
-                    if w.has_private_keys:
-                        sig_count += w.sign_input(psbtv, i, sig_stream, inp_sighash, inp)
-                # sign with keystore
-                sig_count += self.keystore.sign_input(psbtv, i, sig_stream, inp_sighash, inp)
-                # add separator
-                sig_stream.write(b"\x00")
+        # common sighash data computed once for all inputs and signers
+        ctx = SighashContext(psbtv, sighash)
+        with ramstore.open(self.tempdir+"/sigs", "wb") as sig_stream:
+            if not any([w.has_private_keys for w in wallets if w is not None]):
+                # only keystore signs - do it in one batch
+                # so shared derivation prefixes are derived once
+                requests = self._sign_requests(psbtv, ctx, plan)
+                sig_count = self.keystore.sign_inputs(psbtv, requests, sig_stream, ctx=ctx)
+            else:
+                for i in range(psbtv.num_inputs):
+                    self.show_loader(title="Signing input %d of %d" % (i+1, psbtv.num_inputs),
+                             progress=i / psbtv.num_inputs)
+                    inp = ctx.input(i)
+                    inp_sighash = ctx.input_sighash(inp, self.DEFAULT_SIGHASH)
+                    for w in wallets:
+                        if w is None:
+                            continue
+                        # sign with wallet if it has private keys
+                        if w.has_private_keys:
+                            sig_count += w.sign_input(psbtv, i, sig_stream, inp_sighash, inp, ctx=ctx)
+                    # sign with keystore
+                    if plan is None or plan.is_mine(i):
+                        sig_count += self.keystore.sign_input(psbtv, i, sig_stream, inp_sighash, inp, ctx=ctx)
+                    # add separator
+                    sig_stream.write(b"\x00")
         if sig_count == 0:
             raise WalletError("We didn't add any signatures!\n\nMaybe you forgot to import the wallet?\n\nScan the wallet descriptor to import it.")
         # remove unnecessary stuff:
-        with open(self.tempdir+"/sigs", "rb") as sig_stream:
+        with ramstore.open(self.tempdir+"/sigs", "rb") as sig_stream:
             psbtv.write_to(out_stream, compress=CompressMode.PARTIAL, extra_input_streams=[sig_stream])
 
 
+    def _sign_requests(self, psbtv, ctx, plan=None):
+        """
+        Generates (index, derivations, sighash, is taproot) of inputs for keystore.sign_inputs,
+        from the plan if we have it, otherwise from parsed inputs.
+        """
+        for i in range(psbtv.num_inputs):
+            self.show_loader(title="Signing input %d of %d" % (i+1, psbtv.num_inputs),
+                             progress=i / psbtv.num_inputs)
+            if plan is not None:
+                if not plan.is_mine(i):
+                    yield i, [], None, False
+                    continue
+                ders, sighash_type, taproot = plan.inputs[i]
+                yield i, ders, ctx.sighash or sighash_type or self.DEFAULT_SIGHASH, taproot
+                continue
+            inp = ctx.input(i)
+            # input is cached in ctx, keystore gets it again for free
+            yield i, self.keystore.input_derivations(inp), ctx.input_sighash(inp, self.DEFAULT_SIGHASH), None
+
     def wipe(self):
         """Deletes all wallets info"""
         self.wallets = []
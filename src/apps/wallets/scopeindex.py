@@ -0,0 +1,91 @@
+from array import array
+from embit import compact
+
+
+def key_hash(key: bytes) -> int:
+    """16-bit hash of the key, fits into small int"""
+    h = len(key)
+    for b in key:
+        h = ((h * 31) + b) & 0xFFFF
+    return h
+
+
+class ScopeIndex:
+    """
+    Compact index of keys in all input and output scopes of PSBTView,
+    built in one pass over the stream.
+    Keeps only hashes and offsets in arrays, so it stays small
+    even for transactions with hundreds of inputs.
+    Scopes are numbered as in seek_to_scope - inputs first, then outputs.
+    """
+
+    def __init__(self, psbtv):
+        self.stream = psbtv.stream
+        num_scopes = psbtv.num_inputs + psbtv.num_outputs
+        # absolute offset of every scope
+        self.scope_offsets = array("I", [0] * num_scopes)
+        # index of the first key of every scope + total number of keys
+        self.scope_keys = array("I", [0] * (num_scopes + 1))
+        # hashes of keys, offsets of keys and values
+        self.hashes = array("H")
+        self.key_offsets = array("I")
+        self.value_offsets = array("I")
+        self._build(psbtv.first_scope, num_scopes)
+
+    def _build(self, offset, num_scopes):
+        s = self.stream
+        s.seek(offset)
+        for i in range(num_scopes):
+            self.scope_offsets[i] = offset
+            self.scope_keys[i] = len(self.hashes)
+            while True:
+                key_offset = offset
+                l = compact.read_from(s)
+                offset += len(compact.to_bytes(l))
+                # end of scope
+                if l == 0:
+                    break
+                key = s.read(l)
+                if len(key) != l:
+                    raise ValueError("Failed to read key")
+                offset += l
+                value_offset = offset
+                l = compact.read_from(s)
+                offset += len(compact.to_bytes(l)) + l
+                s.seek(offset)
+                self.hashes.append(key_hash(key))
+                self.key_offsets.append(key_offset)
+                self.value_offsets.append(value_offset)
+        self.scope_keys[num_scopes] = len(self.hashes)
+
+    def __len__(self):
+        return len(self.scope_offsets)
+
+    def scope_offset(self, i: int) -> int:
+        return self.scope_offsets[i]
+
+    def find(self, i: int, key: bytes):
+        """Returns absolute offset of the value for the key in scope i or None"""
+        h = key_hash(key)
+        s = self.stream
+        for j in range(self.scope_keys[i], self.scope_keys[i + 1]):
+            if self.hashes[j] != h:
+                continue
+            # verify the key in case of hash collision
+            s.seek(self.key_offsets[j])
+            l = compact.read_from(s)
+            if l == len(key) and s.read(l) == key:
+                return self.value_offsets[j]
+
+    def seek_to_value(self, i: int, key: bytes):
+        """
+        Moves stream to the value of the key in scope i.
+        Returns offset relative to the beginning of the scope
+        like psbtv.seek_to_value(key, from_current=True) after seek_to_scope(i),
+        or None if key is not in the scope.
+        """
+        off = self.find(i, key)
+        if off is None:
+            return None
+        self.stream.seek(off)
+        return off - self.scope_offsets[i]
@@ -9,12 +9,8 @@ class WalletScreen(QRAlert):
     def __init__(self, wallet, network, idx=None, branch_index=0):
         self.wallet = wallet
         self.network = network
-        self.idx = wallet.unused_recv
-        addr, gap = wallet.get_address(
-            self.idx,
-            network=network,
-            branch_index=branch_index,
-        )
+        self.idx = wallet.unused_recv if idx is None else idx
+        addr = self.get_address(wallet, network, self.idx, branch_index)
         super().__init__(
             "    " + wallet.name + "  #708092 " + lv.SYMBOL.EDIT,
             format_addr(addr, words=4),
@@ -65,9 +61,16 @@ class WalletScreen(QRAlert):
         self.menubtn.align(self.close_button, lv.ALIGN.OUT_TOP_MID, 0, -20)
 
         if idx is not None:
-            self.idx = idx
             self.update_address()
 
+    @staticmethod
+    def get_address(wallet, network, idx, branch_index):
+        # neighbouring addresses are derived in pages so paging is instant
+        size = wallet.ADDRESS_PAGE_SIZE
+        return wallet.address_page(
+            idx // size, network=network, branch_index=branch_index
+        )[idx % size]
+
     @property
     def prefix(self):
         if self.branch_index == 0:
@@ -102,9 +105,8 @@ class WalletScreen(QRAlert):
             self.prv.set_state(lv.btn.STATE.REL)
         else:
             self.prv.set_state(lv.btn.STATE.INA)
-        addr, gap = self.wallet.get_address(
-            self.idx, network=self.network, branch_index=self.branch_index
-        )
+        addr = self.get_address(self.wallet, self.network, self.idx, self.branch_index)
+        gap = self.wallet.gaps[self.branch_index]
         note = "%s address #%d" % (self.prefix, self.idx)
         self.note.set_text(note)
         self.message.set_text(format_addr(addr, words=4))
@@ -0,0 +1,29 @@
+class SighashContext:
+    """
+    Per-transaction signing context shared by all signers.
+    Every input is parsed once for the wallets and the keystore
+    and the sighash forced by the user is resolved in one place.
+    Common BIP143 / BIP341 hashes are memoized by the psbt view itself,
+    so signing reads every input and output a constant number of times
+    (see test_sighash_context).
+    """
+
+    def __init__(self, psbtv, sighash=None):
+        self.psbtv = psbtv
+        # sighash forced by the user, None to use sighashes from inputs
+        self.sighash = sighash
+        # index and scope of the input being signed
+        self.idx = None
+        self.inp = None
+
+    def input(self, i):
+        """Returns input scope i, parsed only once for all signers"""
+        if self.idx != i:
+            # free previous scope before parsing the next one
+            self.inp = None
+            self.inp = self.psbtv.input(i)
+            self.idx = i
+        return self.inp
+
+    def input_sighash(self, inp, default):
+        return self.sighash or inp.sighash_type or default
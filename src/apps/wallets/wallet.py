@@ -2,16 +2,18 @@ from app import AppError
 import platform
 from platform import maybe_mkdir, delete_recursively
 import json
+from binascii import hexlify, unhexlify
 from embit import ec, hashes
 from embit.networks import NETWORKS
 from embit.psbt import DerivationPath
 from embit.descriptor import Descriptor
 from embit.descriptor.checksum import add_checksum
-from embit.descriptor.arguments import AllowedDerivation
+from embit.descriptor.arguments import AllowedDerivation, KeyOrigin
 from embit.transaction import SIGHASH
 from .screens import WalletScreen, WalletInfoScreen
 from .commands import DELETE, EDIT, MENU, INFO, EXPORT
 from gui.screens import Menu, QRAlert, Alert, Prompt
+from helpers import LRUCache
 import lvgl as lv
 
 class WalletError(AppError):
@@ -23,6 +25,13 @@ class Wallet:
     GAP_LIMIT = 20
     DescriptorClass = Descriptor
     Networks = NETWORKS
+    # memory ceiling of the derivation cache in number of derived keys,
+    # a 3-of-5 multisig gets 12 cached children, single key wallets - 32
+    DERIVE_CACHE_KEYS = 60
+    DERIVE_CACHE_MAX = 32
+    # addresses are derived and cached in pages for browsing
+    ADDRESS_PAGE_SIZE = 5
+    ADDRESS_PAGES = 4
 
     def __init__(self, desc, path=None, name="Untitled"):
         self.name = name
@@ -30,12 +39,86 @@ class Wallet:
         if self.path is not None:
             self.path = self.path.rstrip("/")
             maybe_mkdir(self.path)
-        self.descriptor = desc
+        # descriptor is None for wallets loaded from the registry,
+        # it is parsed from the wallet folder on first access
+        self._descriptor = desc
+        self._header = None
         # receive and change gap limits
-        self.gaps = [self.GAP_LIMIT for b in range(self.descriptor.num_branches)]
+        self.gaps = [self.GAP_LIMIT for b in range(desc.num_branches)] if desc else []
         self.name = name
         self.unused_recv = 0
         self.keystore = None
+        self._init_cache(len(desc.keys) if desc else 1)
+        # what is already on flash, to skip rewriting unchanged files
+        self._saved_path = None
+        self._saved_meta = None
+
+    def _init_cache(self, num_keys):
+        # (branch, idx) -> [derived descriptor, script_pubkey, derived keys]
+        num_keys = max(num_keys, 1)
+        self._derived = LRUCache(max(2, min(self.DERIVE_CACHE_MAX, self.DERIVE_CACHE_KEYS // num_keys)))
+        # branch -> descriptor with keys already derived to the branch node
+        self._branches = {}
+        # (network, branch, page) -> list of addresses
+        self._pages = LRUCache(self.ADDRESS_PAGES)
+
+    @property
+    def descriptor(self):
+        if self._descriptor is None:
+            self._load_descriptor()
+        return self._descriptor
+
+    @descriptor.setter
+    def descriptor(self, desc):
+        self._descriptor = desc
+        self._header = None
+        self._init_cache(len(desc.keys))
+
+    @property
+    def is_loaded(self):
+        """False if the wallet is known only from its registry header"""
+        return self._descriptor is not None
+
+    def _load_descriptor(self):
+        if self.path is None or self.keystore is None:
+            raise WalletError("Can't load wallet descriptor")
+        _, desc = self.keystore.load_aead(self.path + "/descriptor")
+        descriptor = self.parse_descriptor(desc.decode())
+        if self._header is not None and hexlify(hashes.hash160(str(descriptor))[:4]).decode() != self._header["fingerprint"]:
+            raise WalletError("Wallet descriptor doesn't match the registry")
+        self._descriptor = descriptor
+        self._init_cache(len(descriptor.keys))
+
+    @property
+    def key_origins(self):
+        """
+        List of (fingerprint, derivation tuple) of the key origins,
+        None for keys without origin.
+        Available without parsing the descriptor.
+        """
+        if self._descriptor is None and self._header is not None:
+            return [
+                None if k is None else (unhexlify(k[0]), tuple(k[1]))
+                for k in self._header["keys"]
+            ]
+        return [
+            None if k.origin is None else (k.origin.fingerprint, tuple(k.origin.derivation))
+            for k in self.keys
+        ]
+
+    def get_header(self):
+        """Compact wallet header stored in the wallet registry"""
+        return {
+            "name": self.name,
+            "fingerprint": hexlify(self.fingerprint).decode(),
+            "keys": [
+                None if k is None else [hexlify(k[0]).decode(), list(k[1])]
+                for k in self.key_origins
+            ],
+            "gaps": self.gaps,
+            "unused_recv": self.unused_recv,
+            "watchonly": self.is_watchonly,
+        }
 
     async def show(self, network, show_screen):
         while True:
@@ -100,25 +183,56 @@ class Wallet:
     @property
     def is_watchonly(self):
         """Checks if the wallet is watch-only (doesn't control the key) or not"""
+        # known from the registry header without parsing the descriptor
+        if self._descriptor is None and self._header is not None:
+            return self._header["watchonly"]
         return not (
             any([self.keystore.owns(k) if self.keystore else False for k in self.keys])
             or
             any([k.is_private for k in self.descriptor.keys])
         )
 
-    def save(self, keystore, path=None):
+    def _meta_state(self):
+        return (list(self.gaps), self.name, self.unused_recv)
+
+    @property
+    def is_dirty(self):
+        """True if wallet has changes that are not written to flash yet"""
+        return (self._saved_path is None
+                or self._saved_path != self.path
+                or self._saved_meta != self._meta_state())
+
+    def save(self, keystore, path=None, sync=True):
+        """
+        Writes descriptor and metadata of the wallet.
+        Only files that changed since last save are rewritten.
+        Pass sync=False to coalesce writes of several wallets into one sync.
+        Returns True if anything was written.
+        """
         # wallet has access to keystore only if it's saved or loaded from file
         self.keystore = keystore
         if path is not None:
             self.path = path.rstrip("/")
         if self.path is None:
             raise WalletError("Path is not defined")
-        maybe_mkdir(self.path)
-        desc = str(self.descriptor)
-        keystore.save_aead(self.path + "/descriptor", plaintext=desc.encode())
-        obj = {"gaps": self.gaps, "name": self.name, "unused_recv": self.unused_recv}
-        meta = json.dumps(obj).encode()
-        keystore.save_aead(self.path + "/meta", plaintext=meta)
+        if not self.is_dirty:
+            return False
+        if self._saved_path != self.path:
+            maybe_mkdir(self.path)
+            desc = str(self.descriptor)
+            keystore.save_aead(self.path + "/descriptor", plaintext=desc.encode(), sync=False)
+            # meta has to be written to the new folder as well
+            self._saved_meta = None
+            self._saved_path = self.path
+        state = self._meta_state()
+        if self._saved_meta != state:
+            obj = {"gaps": self.gaps, "name": self.name, "unused_recv": self.unused_recv}
+            meta = json.dumps(obj).encode()
+            keystore.save_aead(self.path + "/meta", plaintext=meta, sync=False)
+            self._saved_meta = state
+        if sync:
+            platform.sync()
+        return True
 
     def check_network(self, network):
         """
@@ -140,35 +254,146 @@ class Wallet:
         if self.path is None:
             raise WalletError("I don't know path...")
         delete_recursively(self.path, include_self=True)
+        self._saved_path = None
+        self._saved_meta = None
 
     def get_address(self, idx: int, network: str, branch_index=0):
-        desc, gap = self.get_descriptor(idx, branch_index)
-        return desc.address(self.Networks[network]), gap
+        self._check_index(idx, branch_index)
+        page = self._pages.get((network, branch_index, idx // self.ADDRESS_PAGE_SIZE))
+        if page is not None:
+            addr = page[idx % self.ADDRESS_PAGE_SIZE]
+        else:
+            addr = self.get_addresses(idx, 1, network, branch_index)[0]
+        return addr, self.gaps[branch_index]
 
-    def get_descriptor(self, idx: int, branch_index=0):
+    def get_addresses(self, start: int, count: int, network: str, branch_index=0):
+        """
+        Derives a contiguous range of addresses.
+        Keys are derived from the branch node,
+        so every address costs a single child derivation.
+        """
+        self._check_index(start, branch_index)
+        self._check_index(start + count - 1, branch_index)
+        net = self.Networks[network]
+        desc = self.branch_descriptor(branch_index)
+        if desc is None:
+            return [self.derive(idx, branch_index).address(net) for idx in range(start, start + count)]
+        return [desc.derive(idx).address(net) for idx in range(start, start + count)]
+
+    def address_page(self, page: int, network: str, branch_index=0):
+        """Returns cached page of ADDRESS_PAGE_SIZE addresses"""
+        key = (network, branch_index, page)
+        addresses = self._pages.get(key)
+        if addresses is None:
+            addresses = self.get_addresses(page * self.ADDRESS_PAGE_SIZE, self.ADDRESS_PAGE_SIZE, network, branch_index)
+            self._pages.put(key, addresses)
+        return addresses
+
+    def find_cached_address(self, addr: str, network: str, matches=None):
+        """Returns (idx, branch_index) if the address is in the page cache"""
+        for (net, branch_index, page), addresses in self._pages.items():
+            if net != network:
+                continue
+            for i, a in enumerate(addresses):
+                if (matches(a, addr) if matches else a == addr):
+                    return page * self.ADDRESS_PAGE_SIZE + i, branch_index
+
+    def branch_descriptor(self, branch_index=0):
+        """
+        Descriptor of the branch with every key replaced by its branch node,
+        so deriving a child takes one derivation per key.
+        Key origins are extended by the branch path,
+        so derived keys are the same as from the full descriptor.
+        None if the descriptor doesn't have the wildcard at the end.
+        """
+        if branch_index in self._branches:
+            return self._branches[branch_index]
+        # private copy, keys are replaced in place
+        desc = self.DescriptorClass.from_string(str(self.descriptor.branch(branch_index)))
+        for k in desc.keys:
+            if not k.is_extended or k.allowed_derivation is None:
+                continue
+            prefix = k.allowed_derivation.fill(0)[:-1]
+            if k.allowed_derivation.fill(1)[:-1] != prefix:
+                desc = None
+                break
+            # origin of the first child without the child index
+            origin = k.derive(0).origin
+            k.origin = KeyOrigin(origin.fingerprint, origin.derivation[:-1])
+            k.key = k.key.derive(prefix)
+            k.allowed_derivation = AllowedDerivation([None])
+        self._branches[branch_index] = desc
+        return desc
+
+    def _check_index(self, idx, branch_index):
         if branch_index < 0 or branch_index >= self.descriptor.num_branches:
             raise WalletError("Invalid branch index %d - can be between 0 and %d" % (branch_index, self.descriptor.num_branches))
         if idx < 0 or idx >= 0x80000000:
             raise WalletError("Invalid index %d" % idx)
-        return self.descriptor.derive(idx, branch_index=branch_index), self.gaps[branch_index]
+
+    def get_descriptor(self, idx: int, branch_index=0):
+        self._check_index(idx, branch_index)
+        return self.derive(idx, branch_index), self.gaps[branch_index]
+
+    def _derive_entry(self, idx, branch_index):
+        key = (branch_index, idx)
+        entry = self._derived.get(key)
+        if entry is None:
+            entry = [self.descriptor.derive(idx, branch_index=branch_index), None, None]
+            self._derived.put(key, entry)
+        return entry
+
+    def derive(self, idx: int, branch_index=0):
+        """
+        Returns child descriptor at branch_index/idx.
+        Derived descriptors with their scripts and pubkeys
+        are kept in a bounded LRU cache shared by scope filling,
+        gap updates, signing and address display.
+        """
+        return self._derive_entry(idx, branch_index)[0]
+
+    def derived_script_pubkey(self, idx: int, branch_index=0):
+        """Returns cached script_pubkey of the child descriptor"""
+        entry = self._derive_entry(idx, branch_index)
+        if entry[1] is None:
+            entry[1] = entry[0].script_pubkey()
+        return entry[1]
+
+    def derived_keys(self, idx: int, branch_index=0):
+        """Returns cached list of (fingerprint, pubkey, derivation) of the child keys"""
+        entry = self._derive_entry(idx, branch_index)
+        if entry[2] is None:
+            entry[2] = [(k.fingerprint, k.get_public_key(), k.derivation) for k in entry[0].keys]
+        return entry[2]
 
     def script_pubkey(self, derivation: list):
         """Returns script_pubkey and gap limit"""
         # derivation can be only two elements
         branch_idx, idx = derivation
-        desc, gap = self.get_descriptor(idx, branch_idx)
-        return desc.script_pubkey(), gap
+        self.get_descriptor(idx, branch_idx)
+        return self.derived_script_pubkey(idx, branch_idx), self.gaps[branch_idx]
 
     @property
     def fingerprint(self):
         """Fingerprint of the wallet - hash160(descriptor)"""
+        if self._descriptor is None and self._header is not None:
+            return unhexlify(self._header["fingerprint"])
         return hashes.hash160(str(self.descriptor))[:4]
 
     def owns(self, psbt_scope):
         """
         Checks that psbt scope belongs to the wallet.
+        Same as descriptor.owns: the first derivation of the scope
+        that matches our keys decides, its script_pubkey must match.
+        Uses cached derivation so filling the scope afterwards is free.
         """
-        return self.descriptor.owns(psbt_scope)
+        if psbt_scope.script_pubkey is None:
+            return False
+        der = self.get_derivation(psbt_scope.bip32_derivations, psbt_scope.taproot_bip32_derivations)
+        if der is None:
+            return False
+        idx, branch_idx = der
+        return self.derived_script_pubkey(idx, branch_idx) == psbt_scope.script_pubkey
 
     def get_derivation(self, bip32_derivations={}, taproot_bip32_derivations={}):
         # otherwise we need standard derivation
@@ -181,7 +406,12 @@ class Wallet:
             if der is not None:
                 return der
 
-    def update_gaps(self, psbtv=None, known_idxs=None):
+    def update_gaps(self, psbtv=None, known_idxs=None, used_idxs=None):
+        """
+        Updates gaps from derivations in the psbt,
+        from used_idxs - last used index per branch (same result as psbt),
+        or from known_idxs - first unused index per branch.
+        """
         gaps = self.gaps
         # update from psbt
         if psbtv is not None:
@@ -191,8 +421,11 @@ class Wallet:
                     res = self.get_derivation(sc.bip32_derivations, sc.taproot_bip32_derivations)
                     if res is not None:
                         idx, branch_idx = res
-                        if idx + self.GAP_LIMIT > gaps[branch_idx]:
-                            gaps[branch_idx] = idx + self.GAP_LIMIT + 1
+                        self._use_index(gaps, branch_idx, idx)
+        if used_idxs is not None:
+            for branch_idx, idx in enumerate(used_idxs):
+                if idx is not None:
+                    self._use_index(gaps, branch_idx, idx)
         # update from gaps arg
         if known_idxs is not None:
             for i, gap in enumerate(gaps):
@@ -201,6 +434,10 @@ class Wallet:
         self.unused_recv = gaps[0] - self.GAP_LIMIT
         self.gaps = gaps
 
+    def _use_index(self, gaps, branch_idx, idx):
+        if idx + self.GAP_LIMIT > gaps[branch_idx]:
+            gaps[branch_idx] = idx + self.GAP_LIMIT + 1
+
     def fill_scope(self, scope, fingerprint):
         """Fills derivation paths in inputs"""
         if not self.owns(scope):
@@ -209,14 +446,13 @@ class Wallet:
         if der is None:
             return False
         idx, branch_idx = der
-        desc = self.descriptor.derive(idx, branch_index=branch_idx)
+        desc = self.derive(idx, branch_idx)
         # find keys with our fingerprint
-        for key in desc.keys:
-            if key.fingerprint == fingerprint:
-                pub = key.get_public_key()
+        for fp, pub, derivation in self.derived_keys(idx, branch_idx):
+            if fp == fingerprint:
                 # fill our derivations
                 scope.bip32_derivations[pub] = DerivationPath(
-                    fingerprint, key.derivation
+                    fingerprint, derivation
                 )
         # fill script
         scope.witness_script = desc.witness_script()
@@ -267,22 +503,28 @@ class Wallet:
             if der is None:
                 continue
             idx, branch = der
-            derived = self.descriptor.derive(idx, branch_index=branch)
+            derived = self.derive(idx, branch)
             keys = [k for k in derived.keys if k.is_private]
             for k in keys:
                 if k.is_private:
                     psbt.sign_with(k.private_key, sighash)
 
-    def sign_input(self, psbtv, i, sig_stream, sighash=SIGHASH.ALL, extra_scope_data=None):
+    def sign_input(self, psbtv, i, sig_stream, sighash=SIGHASH.ALL, extra_scope_data=None, ctx=None):
+        """
+        Signs input i with private keys of the wallet.
+        ctx is an optional SighashContext shared by all signers of the transaction.
+        """
         if not self.has_private_keys:
             return 0
-        inp = psbtv.input(i)
-        inp.update(extra_scope_data)
+        # extra_scope_data is already parsed input with filled data
+        inp = extra_scope_data
+        if inp is None:
+            inp = ctx.input(i) if ctx else psbtv.input(i)
         der = self.get_derivation(inp.bip32_derivations, inp.taproot_bip32_derivations)
         if der is None:
             return 0
         idx, branch = der
-        derived = self.descriptor.derive(idx, branch_index=branch)
+        derived = self.derive(idx, branch)
         keys = [k for k in derived.keys if k.is_private]
         count = 0
         for k in keys:
@@ -303,7 +545,7 @@ class Wallet:
         return w
 
     @classmethod
-    def from_descriptor(cls, desc:str, path):
+    def parse_descriptor(cls, desc:str):
         # remove checksum if it's there and all spaces
         desc = desc.split("#")[0].replace(" ", "")
         descriptor = cls.DescriptorClass.from_string(desc)
@@ -313,7 +555,28 @@ class Wallet:
                 if k.is_extended:
                     # allow /{0,1}/*
                     k.allowed_derivation = AllowedDerivation.default()
-        return cls(descriptor, path)
+        return descriptor
+
+    @classmethod
+    def from_descriptor(cls, desc:str, path):
+        return cls(cls.parse_descriptor(desc), path)
+
+    @classmethod
+    def from_header(cls, path, header, keystore):
+        """
+        Creates a wallet from the registry header without decrypting
+        and parsing the descriptor - it is loaded on first access.
+        """
+        w = cls(None, path, header["name"])
+        w._header = header
+        w.gaps = list(header["gaps"])
+        w.unused_recv = header["unused_recv"]
+        w._init_cache(len(header["keys"]))
+        w._saved_path = w.path
+        w._saved_meta = w._meta_state()
+        # wallet has access to keystore only if it's saved or loaded from file
+        w.keystore = keystore
+        return w
 
     @classmethod
     def from_path(cls, path, keystore):
@@ -329,6 +592,8 @@ class Wallet:
             w.name = obj["name"]
         if "unused_recv" in obj:
             w.unused_recv = obj["unused_recv"]
+        w._saved_path = w.path
+        w._saved_meta = w._meta_state()
         # wallet has access to keystore only if it's saved or loaded from file
         w.keystore = keystore
         return w
@@ -0,0 +1,101 @@
+import json
+import gc
+from binascii import hexlify
+from embit import bip32
+from embit.liquid.networks import NETWORKS
+from keystore.core import KeyStoreError
+
+HARDENED = 0x80000000
+
+
+class XpubExporter:
+    """
+    Bulk export of account xpubs.
+    Walks the derivation tree once: every m/purpose'/coin' node
+    is derived a single time and all accounts are derived from it,
+    both bip48 script types share the account node.
+    Accounts are written to the file one by one as they are derived.
+    """
+    # (keytype, script type, purpose, bip48 script type)
+    KEYS = [
+        ('bip84', "p2wpkh", 84, None),
+        ('bip86', "p2tr", 86, None),
+        ('bip49', "p2sh-p2wpkh", 49, None),
+        ('bip44', "p2pkh", 44, None),
+        ('bip48_1', "p2sh-p2wsh", 48, 1),
+        ('bip48_2', "p2wsh", 48, 2),
+    ]
+
+    def __init__(self, keystore, network):
+        self.keystore = keystore
+        self.network = network
+        self.net = NETWORKS[network]
+        self.coin = self.net["bip32"]
+        self.fingerprint = hexlify(keystore.fingerprint).decode()
+        self._coin_nodes = None
+        self._master = None
+
+    def _coin_node(self, purpose):
+        if self._coin_nodes is None:
+            self._coin_nodes = {}
+        node = self._coin_nodes.get(purpose)
+        if node is None:
+            # derived from the root directly, so private nodes
+            # don't stay in the keystore derivation cache
+            ks = self.keystore
+            if ks.is_locked or ks.root is None:
+                raise KeyStoreError("Keystore is not ready")
+            node = ks.root.derive([purpose + HARDENED, self.coin + HARDENED])
+            self._coin_nodes[purpose] = node
+        return node
+
+    def account_keys(self, account):
+        """Returns list of (keytype, script type, derivation, xpub) of the account"""
+        res = []
+        account_nodes = {}
+        for keytype, scripttype, purpose, script in self.KEYS:
+            node = account_nodes.get(purpose)
+            if node is None:
+                node = self._coin_node(purpose).child(account + HARDENED)
+                account_nodes[purpose] = node
+            der = "m/%d'/%d'/%d'" % (purpose, self.coin, account)
+            if script is not None:
+                node = node.child(script + HARDENED)
+                der += "/%d'" % script
+            res.append((keytype, scripttype, der, node.to_public()))
+        return res
+
+    def close(self):
+        """Drops derived private nodes"""
+        self._coin_nodes = None
+        gc.collect()
+
+    def write_specter_diy(self, f, account):
+        for keytype, scripttype, der, xpub in self.account_keys(account):
+            f.write("[%s/%s]%s\n" % (
+                self.fingerprint,
+                der.replace("m/", "").replace("'", "h"),
+                xpub.to_base58(self.net["xpub"]),
+            ))
+
+    def write_coldcard(self, f, account):
+        """Coldcard generic json format, written field by field"""
+        if self._master is None:
+            self._master = self.keystore.get_xpub("m").to_base58(self.net["xpub"])
+        f.write('{"xpub": %s, "xfp": %s, "account": %d, "chain": %s' % (
+            json.dumps(self._master),
+            json.dumps(self.fingerprint),
+            account,
+            json.dumps("BTC" if self.network == "main" else "XTN"),
+        ))
+        for keytype, scripttype, der, xpub in self.account_keys(account):
+            f.write(', %s: ' % json.dumps(keytype))
+            json.dump({
+                "name": scripttype,
+                "deriv": der,
+                "xpub": xpub.to_base58(self.net["xpub"]),
+                "_pub": xpub.to_base58(
+                    bip32.detect_version(der, default="xpub", network=self.net)
+                ),
+            }, f)
+        f.write("}")
@@ -1,6 +1,7 @@
 from app import BaseApp, AppError
 from gui.screens import Menu, DerivationScreen, NumericScreen, Alert, InputScreen, Prompt
 from .screens import XPubScreen
+from .export import XpubExporter
 import json
 from binascii import hexlify
 from embit.liquid.networks import NETWORKS
@@ -138,7 +139,7 @@ class XpubApp(BaseApp):
             return True
         return False
 
-    async def save_all_to_sd(self, file_format, account, show_screen):
+    async def save_all_to_sd(self, file_format, account, show_screen, exporter=None):
 
         fingerprint = hexlify(self.keystore.fingerprint).decode()
 
@@ -156,7 +157,7 @@ class XpubApp(BaseApp):
                 if not confirm:
                     return
             with sd.open(filename, "w") as f:
-                self._dump_account(f, file_format, account)
+                self._dump_account(f, file_format, account, exporter)
 
         return filename
 
@@ -172,6 +173,14 @@ class XpubApp(BaseApp):
         if to_account >= 0x80000000:
             raise AppError('Account number too large')
         fingerprint = hexlify(self.keystore.fingerprint).decode()
+        # purpose and coin nodes are derived once for all accounts
+        exporter = XpubExporter(self.keystore, self.network)
+        try:
+            await self._export_accounts(exporter, from_account, to_account, file_format, fingerprint, show_screen)
+        finally:
+            exporter.close()
+
+    async def _export_accounts(self, exporter, from_account, to_account, file_format, fingerprint, show_screen):
         if file_format == self.export_specter_diy:
             # in our format we can dump any number of accounts in one file
             filename = "%s-%s-%d-%d.txt" % (
@@ -184,8 +193,9 @@ class XpubApp(BaseApp):
                         return
                 with sd.open(filename, "w") as f:
                     for account in range(from_account, to_account+1):
-                        self.show_loader(title="Exporting account %d..." % account)
-                        self._dump_account(f, file_format, account)
+                        self.show_loader(title="Exporting account %d..." % account,
+                                         progress=(account - from_account) / (to_account - from_account + 1))
+                        self._dump_account(f, file_format, account, exporter)
             await show_screen(
                 Alert(
                     "Success!",
@@ -195,8 +205,9 @@ class XpubApp(BaseApp):
             )
         else: # cc format - one file per account
             for account in range(from_account, to_account+1):
-                self.show_loader(title="Exporting account %d..." % account)
-                await self.save_all_to_sd(file_format, account, show_screen)
+                self.show_loader(title="Exporting account %d..." % account,
+                                 progress=(account - from_account) / (to_account - from_account + 1))
+                await self.save_all_to_sd(file_format, account, show_screen, exporter)
             await show_screen(
                 Alert(
                     "Success!",
@@ -205,54 +216,19 @@ class XpubApp(BaseApp):
                 )
             )
 
-    def _dump_account(self, f, file_format, account):
+    def _dump_account(self, f, file_format, account, exporter=None):
         """dump all keys of one account to a file"""
-        coin = NETWORKS[self.network]["bip32"]
-        derivations = [
-            ('bip84', "p2wpkh", "m/84'/%d'/%d'" % (coin, account)),
-            ('bip86', "p2tr", "m/86'/%d'/%d'" % (coin, account)),
-            ('bip49', "p2sh-p2wpkh", "m/49'/%d'/%d'" % (coin, account)),
-            ('bip44', "p2pkh", "m/44'/%d'/%d'" % (coin, account)),
-            ('bip48_1', "p2sh-p2wsh", "m/48'/%d'/%d'/1'" % (coin, account)),
-            ('bip48_2', "p2wsh", "m/48'/%d'/%d'/2'" % (coin, account)),
-        ]
-        fingerprint = hexlify(self.keystore.fingerprint).decode()
-
-        if file_format == self.export_specter_diy:
-            for keytype, scripttype, der in derivations:
-                xpub = self.keystore.get_xpub(der)
-                f.write("[%s/%s]%s\n" % (
-                    fingerprint,
-                    der.replace("m/", "").replace("'","h"),
-                    xpub.to_base58(NETWORKS[self.network]["xpub"]),
-                ))
-        else:
-            # coldcard generic json format
-            m = self.keystore.get_xpub("m")
-            data = {
-                "xpub": m.to_base58(NETWORKS[self.network]["xpub"]),
-                "xfp": fingerprint,
-                "account": account,
-                "chain": "BTC" if self.network == "main" else "XTN"
-            }
-
-            for keytype, scripttype, der in derivations:
-                xpub = self.keystore.get_xpub(der)
-
-                data[keytype] = {
-                    "name": scripttype,
-                    "deriv": der,
-                    "xpub": xpub.to_base58(NETWORKS[self.network]["xpub"]),
-                    "_pub": xpub.to_base58(
-                        bip32.detect_version(
-                            der,
-                            default="xpub",
-                            network=NETWORKS[self.network]
-                        )
-                    )
-                }
-
-            json.dump(data, f)
+        own = exporter is None
+        if own:
+            exporter = XpubExporter(self.keystore, self.network)
+        try:
+            if file_format == self.export_specter_diy:
+                exporter.write_specter_diy(f, account)
+            else:
+                exporter.write_coldcard(f, account)
+        finally:
+            if own:
+                exporter.close()
 
     async def process_host_command(self, stream, show_screen):
         if self.keystore.is_locked:
@@ -21,3 +21,17 @@ else:
 # pin that triggers QR code
 # if command mode failed
 QRSCANNER_TRIGGER = "D2"
+
+# sign from the state collected while parsing the transaction,
+# see WalletManager.sign_psbtview
+PIPELINED_SIGNING = False
+
+# RAM for transient files (host data, temp PSBTs), bytes,
+# bigger files go to /sdram, see ramstore.py
+RAMSTORE_SIZE = 128 * 1024
+
+# collect timings of hot paths, see profiler.py
+PROFILER = False
+
+# minimal interval between loader progress redraws, ms
+LOADER_INTERVAL = 200
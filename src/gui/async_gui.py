@@ -1,12 +1,16 @@
 import asyncio
+import time
 from .core import init, update
 from .screens import Menu, Alert, QRAlert, Prompt, InputScreen
+from .screens.progress import LOADER_INTERVAL
 from .components.modal import Modal
 from .components.battery import Battery
 import lvgl as lv
 
 
 class AsyncGUI:
+    LOADER_INTERVAL = LOADER_INTERVAL
+
     def __init__(self):
         # unlock event for host signalling
         # to avoid spamming GUI
@@ -17,6 +21,8 @@ class AsyncGUI:
         self.scr = None
         self.battery_callback = None
         self.battery_interval = 1000
+        # time of the last loader redraw, None if loader is hidden
+        self._loader_time = None
 
     def set_battery_callback(self, cb, dt=1000):
         self.battery_callback = cb
@@ -32,11 +38,26 @@ class AsyncGUI:
 
     def show_loader(self,
                     text="Please wait until the process is complete.",
-                    title="Processing..."):
-        if self.scr is not None:
-            self.scr.show_loader(text, title)
+                    title="Processing...",
+                    progress=None):
+        """
+        Shows the loader on the active screen.
+        progress is a number between 0 and 1 for determinate progress,
+        such updates are redrawn at most once per LOADER_INTERVAL,
+        updates in between are dropped as the next one supersedes them.
+        Updates without progress start a new stage and are always drawn.
+        """
+        if self.scr is None:
+            return
+        now = time.ticks_ms()
+        if (progress is not None and self._loader_time is not None
+                and time.ticks_diff(now, self._loader_time) < self.LOADER_INTERVAL):
+            return
+        self._loader_time = now
+        self.scr.show_loader(text, title, progress)
 
     def hide_loader(self):
+        self._loader_time = None
         if self.scr is None:
             return
         self.scr.hide_loader()
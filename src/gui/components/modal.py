@@ -17,9 +17,19 @@ class Modal(lv.obj):
         self.set_pos(0, 0)
         self.set_size(parent.get_width(), parent.get_height())
 
+        self.bar = None
         self.mbox = lv.mbox(self)
         self.mbox.set_width(400)
         self.mbox.align(None, lv.ALIGN.IN_TOP_MID, 0, 200)
 
     def set_text(self, text):
         self.mbox.set_text(text)
+
+    def set_progress(self, val):
+        """Shows determinate progress bar, val is between 0 and 1"""
+        if self.bar is None:
+            self.bar = lv.bar(self.mbox)
+            self.bar.set_size(340, 16)
+            self.bar.set_range(0, 100)
+        self.bar.set_value(int(100 * min(max(val, 0), 1)), lv.ANIM.OFF)
+        self.bar.align(self.mbox, lv.ALIGN.IN_BOTTOM_MID, 0, -20)
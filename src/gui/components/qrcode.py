@@ -5,6 +5,7 @@ import math
 import gc
 import asyncio
 import platform
+import profiler
 
 from io import BytesIO
 from qrencoder import QREncoder
@@ -22,12 +23,60 @@ qr_style.body.radius = 10
 QR_SIZES = [17, 32, 53, 78, 106, 154, 192, 230, 271, 367, 458, 586, 718, 858]
 BTNSIZE = 70
 
+
+class FrameCache:
+    """
+    Payloads of animated QR frames filled lazily during playback,
+    so loops don't seek and format parts every tick.
+    Infinite encoders are never cached, total payload size is limited.
+    """
+
+    def __init__(self, max_size):
+        self.max_size = max_size
+        self.clear()
+
+    def clear(self):
+        self.frames = {}
+        self.size = 0
+
+    def get(self, encoder, idx):
+        payload = self.frames.get(idx)
+        if payload is not None:
+            return payload
+        with profiler.span("qr.encode"):
+            payload = encoder[idx]
+        if not encoder.is_infinite and self.size + len(payload) <= self.max_size:
+            self.frames[idx] = payload
+            self.size += len(payload)
+        return payload
+
+
+def auto_density(encoder, max_version, max_frames):
+    """
+    Returns the lowest QR version (index in QR_SIZES) that fits
+    the data in max_frames frames, or max_version if data is bigger.
+    Sparse frames are easier to scan from the screen,
+    so density grows only to keep the number of frames low.
+    """
+    for v in range(1, max_version):
+        if encoder.num_parts(QR_SIZES[v]) <= max_frames:
+            return v
+    return max_version
+
 class QRCode(lv.obj):
     RATE = 500  # ms
     FRAME_SIZE = 300
     QR_VERSION = 10
     MIN_SIZE = 300
     MAX_SIZE = QR_SIZES[-1]
+    # max total length of cached frame payloads
+    FRAME_CACHE_SIZE = 20000
+    # auto density: densest version reliably scanned from the screen
+    AUTO_MAX_VERSION = 10
+    # auto density: target number of frames
+    AUTO_MAX_FRAMES = 10
+    # fastest frame rate for small QR codes, ms
+    MIN_RATE = 200
 
     def __init__(self, *args, **kwargs):
         super().__init__(*args, **kwargs)
@@ -38,10 +87,12 @@ class QRCode(lv.obj):
 
         self.encoder = None
         self._autoplay = True
+        self._frames = FrameCache(self.FRAME_CACHE_SIZE)
 
         self.qr = lvqr.QRCode(self)
         self._text = "Text"
         self.version = self.QR_VERSION
+        self.rate = self.RATE
 
         self._original_size = None
         self._press_start = None
@@ -150,7 +201,7 @@ class QRCode(lv.obj):
                     self.idx += 1
                 if not (self.encoder and self.encoder.is_infinite):
                     self.idx = self.idx % self.frame_num
-            await asyncio.sleep_ms(self.RATE)
+            await asyncio.sleep_ms(self.rate)
 
     def on_plus(self, obj, event):
         if event == lv.EVENT.RELEASED and (self.version + 1) < len(QR_SIZES):
@@ -158,8 +209,8 @@ class QRCode(lv.obj):
             if self.idx is not None:
                 self.idx = 0
             if self.encoder:
-                self.encoder.part_len = QR_SIZES[self.version]
-                self.frame_num = len(self.encoder)
+                self.set_density(self.version)
+                self.encoder.qr_version = self.version
 
     def on_minus(self, obj, event):
         if event == lv.EVENT.RELEASED and self.version > 0:
@@ -167,8 +218,8 @@ class QRCode(lv.obj):
             if self.idx is not None:
                 self.idx = 0
             if self.encoder:
-                self.encoder.part_len = QR_SIZES[self.version]
-                self.frame_num = len(self.encoder)
+                self.set_density(self.version)
+                self.encoder.qr_version = self.version
 
     def on_pause(self, obj, event):
         if event == lv.EVENT.RELEASED:
@@ -243,28 +294,54 @@ class QRCode(lv.obj):
         self.play.align(self, lv.ALIGN.IN_BOTTOM_MID, 0, -150)
         self.check_controls()
 
+    def set_density(self, version, rate=None):
+        self.version = version
+        self.rate = rate or self.RATE
+        self.encoder.part_len = QR_SIZES[version]
+        self.frame_num = len(self.encoder)
+        self.invalidate_frames()
+
+    def frame_rate(self, version):
+        """Denser frames need more time for the scanner to decode"""
+        return max(self.MIN_RATE, self.RATE * QR_SIZES[version] // QR_SIZES[self.QR_VERSION])
+
+    def invalidate_frames(self):
+        self._frames.clear()
+
+    def get_frame(self, idx):
+        """Returns payload of the frame idx"""
+        return self._frames.get(self.encoder, idx)
+
     def set_text(self, text="Text", set_first_frame=False):
         if platform.simulator and self._text != text:
             print("QR on screen:", text)
         self.encoder = None
+        self.invalidate_frames()
         self._text = text
         if isinstance(text, QREncoder):
             self.encoder = text
             self._text = text.get_full(self.MAX_SIZE)
             self.frame_num = len(self.encoder)
             if not self._text: # we can't get full data in one QR
+                if text.qr_version is None:
+                    v = auto_density(self.encoder, self.AUTO_MAX_VERSION, self.AUTO_MAX_FRAMES)
+                    self.set_density(v, self.frame_rate(v))
+                else:
+                    self.set_density(text.qr_version)
                 self.idx = 0
-                self.set_frame()
+                self.set_frame(force=True)
                 self._autoplay = True
                 return
         self.idx = None
         self._set_text(self._text)
         self.update_note()
 
-    def set_frame(self):
+    def set_frame(self, force=False):
         if self.encoder:
-            payload = self.encoder[self.idx]
-            self._set_text(payload)
+            payload = self.get_frame(self.idx)
+            # skip QR encoding if frame didn't change (paused or single frame)
+            if force or payload != self.qr.get_text():
+                self._set_text(payload)
             if self.encoder.is_infinite:
                 note = ""
             else:
@@ -291,7 +368,8 @@ class QRCode(lv.obj):
         # one bcur frame doesn't require checksum
         print(text)
         self.set_style(qr_style)
-        self.qr.set_text(text)
+        with profiler.span("qr.display"):
+            self.qr.set_text(text)
         self.qr.align(self, lv.ALIGN.CENTER, 0, -100 if self.is_fullscreen else 0)
         self.note.align(self, lv.ALIGN.IN_BOTTOM_MID, 0, 0)
 
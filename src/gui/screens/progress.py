@@ -1,14 +1,21 @@
 import lvgl as lv
+import time
+import platform
 from .alert import Alert
 from ..common import add_label
 
+# progress redraws closer than this (ms) are coalesced
+LOADER_INTERVAL = getattr(platform.config, "LOADER_INTERVAL", 200)
+
 
 class Progress(Alert):
     """
     Shows progress (rotating thingy), also can show
     percentage of the progress or checkboxes for parts of QR code
     Use tick() to rotate, set_progress(float or list) to set progress
+    Percentage redraws are coalesced to one per LOADER_INTERVAL.
     """
+    LOADER_INTERVAL = LOADER_INTERVAL
 
     def __init__(self, title, message, button_text="Cancel"):
         super().__init__(title, message, button_text=button_text)
@@ -21,6 +28,8 @@ class Progress(Alert):
         self.progress = add_label("", scr=self, style="title")
         self.progress.align(self.message, lv.ALIGN.OUT_BOTTOM_MID, 0, 30)
         self.progress.set_recolor(True)
+        self._txt = ""
+        self._time = None
 
     def tick(self, d: int = 10):
         self.start = (self.start - 2 * d) % 360
@@ -35,4 +44,13 @@ class Progress(Alert):
             txt = " ".join([ok if e else no for e in val])
         elif val > 0:
             txt = "%d%%" % int(val * 100)
+        if txt == self._txt:
+            return
+        now = time.ticks_ms()
+        # checkboxes are always redrawn, percentage only if enough time passed
+        if (not isinstance(val, list) and val < 1 and self._time is not None
+                and time.ticks_diff(now, self._time) < self.LOADER_INTERVAL):
+            return
+        self._time = now
+        self._txt = txt
         self.progress.set_text(txt)
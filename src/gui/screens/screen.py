@@ -58,10 +58,13 @@ class Screen(lv.obj):
 
     def show_loader(self,
                     text="Please wait until the process is complete.",
-                    title="Processing..."):
+                    title="Processing...",
+                    progress=None):
         if self.mbox is None:
             self.mbox = Modal(self)
         self.mbox.set_text("\n\n"+title+"\n\n"+text+"\n\n")
+        if progress is not None:
+            self.mbox.set_progress(progress)
         # trigger update of the screen
         update()
         update()
@@ -11,6 +11,8 @@ from embit.liquid.networks import NETWORKS
 AES_BLOCK = 16
 IV_SIZE = 16
 AES_CBC = 2
+# plaintext chunk of streaming AEAD, multiple of AES_BLOCK
+AEAD_CHUNK = 512
 
 def is_liquid(network):
     if isinstance(network, str):
@@ -70,15 +72,13 @@ def aead_encrypt(key: bytes, adata: bytes = b"", plaintext: bytes = b"") -> byte
     """
     Encrypts and authenticates with associated data using key k.
     output format: <compact-len:associated data><iv><ct><hmac>
+    Output is built in memory, for short records only,
+    files are written with AEADWriter or aead_encrypt_stream.
     """
-    aes_key = tagged_hash("aes", key)
-    hmac_key = tagged_hash("hmac", key)
-    data = compact.to_bytes(len(adata)) + adata
-    # if there is not ct - just add hmac
-    if len(plaintext) > 0:
-        data += encrypt(plaintext, aes_key)
-    mac = hmac.new(hmac_key, data, digestmod="sha256").digest()
-    return data + mac
+    b = BytesIO()
+    with AEADWriter(key, b, adata) as f:
+        f.write(plaintext)
+    return b.getvalue()
 
 
 def aead_decrypt(ciphertext: bytes, key: bytes) -> tuple:
@@ -87,22 +87,328 @@ def aead_decrypt(ciphertext: bytes, key: bytes) -> tuple:
     Inverse to aead_encrypt
     Returns a tuple adata, plaintext
     """
-    mac = ciphertext[-32:]
-    ct = ciphertext[:-32]
+    return aead_decrypt_stream(BytesIO(ciphertext), key, size=len(ciphertext))
 
-    aes_key = tagged_hash("aes", key)
-    hmac_key = tagged_hash("hmac", key)
-    if mac != hmac.new(hmac_key, ct, digestmod="sha256").digest():
+
+def _readfull(stream, buf):
+    """Reads from stream until buf is full, returns number of bytes read"""
+    mv = memoryview(buf)
+    n = 0
+    while n < len(buf):
+        r = stream.readinto(mv[n:])
+        if not r:
+            break
+        n += r
+    return n
+
+
+class AEADWriter:
+    """
+    File-like object encrypting everything written to it
+    in the aead_encrypt format, chunk by chunk:
+    CBC state and HMAC are updated incrementally,
+    so only one chunk of plaintext is kept in memory.
+    close() adds the padding and the HMAC.
+    """
+
+    def __init__(self, key: bytes, fout, adata: bytes = b"", chunk_size: int = AEAD_CHUNK):
+        if chunk_size % AES_BLOCK != 0:
+            raise ValueError("Chunk size should be a multiple of %d" % AES_BLOCK)
+        self.fout = fout
+        self.aes_key = tagged_hash("aes", key)
+        self.hmac = hmac.new(tagged_hash("hmac", key), digestmod="sha256")
+        self.crypto = None
+        # extra block for the padding
+        self.buf = bytearray(chunk_size + AES_BLOCK)
+        self.out = bytearray(chunk_size + AES_BLOCK)
+        self.chunk_size = chunk_size
+        self.pos = 0
+        self.size = 0
+        self._write(compact.to_bytes(len(adata)) + adata)
+
+    def _write(self, data):
+        self.hmac.update(data)
+        self.fout.write(data)
+        self.size += len(data)
+
+    def _encrypt(self, n):
+        self.crypto.encrypt(memoryview(self.buf)[:n], memoryview(self.out)[:n])
+        self._write(memoryview(self.out)[:n])
+
+    def write(self, data):
+        if isinstance(data, str):
+            data = data.encode()
+        if len(data) == 0:
+            return 0
+        if self.crypto is None:
+            iv = rng.get_random_bytes(IV_SIZE)
+            self.crypto = aes(self.aes_key, AES_CBC, iv)
+            self._write(iv)
+        mv = memoryview(data)
+        done = 0
+        while done < len(data):
+            l = min(len(data) - done, self.chunk_size - self.pos)
+            self.buf[self.pos:self.pos + l] = mv[done:done + l]
+            self.pos += l
+            done += l
+            if self.pos == self.chunk_size:
+                self._encrypt(self.pos)
+                self.pos = 0
+        return len(data)
+
+    def close(self):
+        """Encrypts the padded tail and writes the HMAC, returns total size"""
+        if self.buf is None:
+            return self.size
+        # if there is not ct - just add hmac
+        if self.crypto is not None:
+            # bit padding (0x80 and zeroes) to the block size
+            n = self.pos + AES_BLOCK - (self.pos % AES_BLOCK)
+            self.buf[self.pos] = 0x80
+            for i in range(self.pos + 1, n):
+                self.buf[i] = 0
+            self._encrypt(n)
+        self.fout.write(self.hmac.digest())
+        self.size += 32
+        self.buf = None
+        self.out = None
+        self.crypto = None
+        return self.size
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, *args):
+        if exc_type is None:
+            self.close()
+
+
+def aead_encrypt_stream(key: bytes, fout, adata: bytes = b"", fin=None, chunk_size: int = AEAD_CHUNK) -> int:
+    """
+    Streaming version of aead_encrypt.
+    Reads plaintext from fin and writes the result to fout.
+    Returns number of bytes written.
+    """
+    with AEADWriter(key, fout, adata, chunk_size) as f:
+        if fin is not None:
+            buf = bytearray(chunk_size)
+            while True:
+                n = _readfull(fin, buf)
+                if n == 0:
+                    break
+                f.write(buf if n == chunk_size else memoryview(buf)[:n])
+    return f.size
+
+
+def aead_decrypt_stream(fin, key: bytes, fout=None, size=None, chunk_size: int = AEAD_CHUNK) -> tuple:
+    """
+    Streaming version of aead_decrypt, fin should be seekable.
+    Verifies the HMAC in the first pass and decrypts in the second one,
+    so nothing is decrypted before the data is authenticated.
+    size - length of the data from the current position, by default till the end.
+    If fout is passed plaintext is written to it
+    and a tuple (adata, plaintext length) is returned,
+    otherwise returns a tuple (adata, plaintext).
+    """
+    start = fin.tell()
+    if size is None:
+        size = fin.seek(0, 2) - start
+        fin.seek(start)
+    if size < 33:
+        raise Exception("Invalid length")
+    h = hmac.new(tagged_hash("hmac", key), digestmod="sha256")
+    buf = bytearray(chunk_size)
+    left = size - 32
+    while left > 0:
+        n = _readfull(fin, memoryview(buf)[:min(left, chunk_size)])
+        if n == 0:
+            raise Exception("Invalid length")
+        h.update(memoryview(buf)[:n])
+        left -= n
+    if fin.read(32) != h.digest():
         raise Exception("Invalid HMAC")
-    b = BytesIO(ct)
-    l = compact.read_from(b)
-    adata = b.read(l)
+
+    fin.seek(start)
+    l = compact.read_from(fin)
+    adata = fin.read(l)
     if len(adata) != l:
         raise Exception("Invalid length")
-    ct = b.read()
-    if len(ct) == 0:
-        return adata, b""
-    return adata, decrypt(ct, aes_key)
+    left = size - 32 - len(compact.to_bytes(l)) - l
+    if left == 0:
+        return adata, (0 if fout is not None else b"")
+    if left < IV_SIZE + AES_BLOCK or left % AES_BLOCK != 0:
+        raise Exception("Invalid length")
+    crypto = aes(tagged_hash("aes", key), AES_CBC, fin.read(IV_SIZE))
+    left -= IV_SIZE
+    # without fout plaintext is decrypted to a single preallocated buffer
+    res = None if fout is not None else bytearray(left)
+    out = bytearray(chunk_size) if fout is not None else None
+    total = 0
+    while left > 0:
+        n = _readfull(fin, memoryview(buf)[:min(left, chunk_size)])
+        if n == 0 or n % AES_BLOCK != 0:
+            raise Exception("Invalid length")
+        left -= n
+        dst = memoryview(out)[:n] if res is None else memoryview(res)[total:total + n]
+        crypto.decrypt(memoryview(buf)[:n], dst)
+        if left == 0:
+            # remove padding from the last block: 80 00 ... 00
+            i = n - 1
+            while i >= n - AES_BLOCK and dst[i] == 0:
+                i -= 1
+            if i < n - AES_BLOCK or dst[i] != 0x80:
+                raise Exception("Invalid padding")
+            n = i
+        if res is None:
+            fout.write(dst[:n])
+        total += n
+    if res is None:
+        return adata, total
+    return adata, bytes(memoryview(res)[:total])
+
+
+class BufferIO:
+    """
+    Minimal file-like object over a memoryview.
+    Allows to keep transient data in preallocated RAM
+    instead of the ramdisk. Raises MemoryError when the buffer is full.
+    """
+
+    def __init__(self, buf, text=False):
+        self.buf = buf
+        self.text = text
+        self.size = 0
+        self.pos = 0
+
+    def write(self, data):
+        if isinstance(data, str):
+            data = data.encode()
+        end = self.pos + len(data)
+        if end > len(self.buf):
+            raise MemoryError("Buffer is full")
+        self.buf[self.pos:end] = data
+        self.pos = end
+        if end > self.size:
+            self.size = end
+        return len(data)
+
+    def read(self, n=-1):
+        end = self.size if (n is None or n < 0) else min(self.size, self.pos + n)
+        res = bytes(self.buf[self.pos:end]) if end > self.pos else b""
+        self.pos = max(self.pos, end)
+        return res.decode() if self.text else res
+
+    def readinto(self, b):
+        end = min(self.size, self.pos + len(b))
+        n = max(end - self.pos, 0)
+        b[:n] = self.buf[self.pos:end]
+        self.pos += n
+        return n
+
+    def seek(self, offset, whence=0):
+        if whence == 1:
+            offset += self.pos
+        elif whence == 2:
+            offset += self.size
+        self.pos = max(0, min(offset, self.size))
+        return self.pos
+
+    def tell(self):
+        return self.pos
+
+    def close(self):
+        pass
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        pass
+
+
+class ReadCounter:
+    """
+    Stream wrapper counting the number of bytes read from the stream.
+    Used to measure I/O of multi-pass parsers.
+    """
+
+    def __init__(self, stream):
+        self.stream = stream
+        self.count = 0
+
+    def read(self, *args):
+        res = self.stream.read(*args)
+        self.count += len(res)
+        return res
+
+    def readinto(self, buf, *args):
+        n = self.stream.readinto(buf, *args)
+        self.count += n or 0
+        return n
+
+    def seek(self, *args):
+        return self.stream.seek(*args)
+
+    def tell(self):
+        return self.stream.tell()
+
+
+class LRUCache:
+    """
+    Small least-recently-used cache with a fixed number of entries.
+    Order is kept in a plain list as caches are small
+    and it keeps the memory footprint predictable.
+    Hits and puts are O(size) because of the list update,
+    fine for the up to 64 entries used here
+    (MicroPython's OrderedDict can't move keys to the end).
+    """
+
+    def __init__(self, size):
+        self.size = size
+        self._data = {}
+        self._order = []
+        self.hits = 0
+        self.misses = 0
+
+    def get(self, key, default=None):
+        if key not in self._data:
+            self.misses += 1
+            return default
+        self.hits += 1
+        # move to the end - most recently used
+        if self._order[-1] != key:
+            self._order.remove(key)
+            self._order.append(key)
+        return self._data[key]
+
+    def put(self, key, value):
+        if key in self._data:
+            self._order.remove(key)
+        elif len(self._order) >= self.size:
+            # evict least recently used
+            del self._data[self._order.pop(0)]
+        self._data[key] = value
+        self._order.append(key)
+
+    def pop(self, key, default=None):
+        if key not in self._data:
+            return default
+        self._order.remove(key)
+        return self._data.pop(key)
+
+    def clear(self):
+        self._data = {}
+        self._order = []
+
+    def items(self):
+        """(key, value) pairs without touching the usage order"""
+        return [(k, self._data[k]) for k in self._order]
+
+    def __contains__(self, key):
+        return key in self._data
+
+    def __len__(self):
+        return len(self._order)
 
 
 def load_apps(module="apps", whitelist=None, blacklist=None):
@@ -19,6 +19,8 @@ class Host:
 
     # time to wait after init
     RECOVERY_TIME = 1
+    # with IRQ wakeups the host is updated at least that often, ms
+    IDLE_TIMEOUT = 1000
     # store device settings here with unique filename
     # common for all hosts
     SETTINGS_DIR = None
@@ -30,6 +32,8 @@ class Host:
     settings_button = None
     # link to specter instance
     parent = None
+    # store QR density selected by the user in the host settings
+    REMEMBER_QR_DENSITY = False
 
     def __init__(self, path):
         # storage for data
@@ -43,6 +47,9 @@ class Host:
         # if disabled - throw all incoming data
         self.enabled = False
         self.initialized = False
+        # flag set from IRQ handlers when new data arrives,
+        # None if the host is polled (simulator)
+        self._wakeup = None
         # default settings, extend it with more settings if applicable
         self.settings = { "enabled": True }
         # if host can be triggered by the user
@@ -83,6 +90,34 @@ class Host:
                            key=keystore.settings_key
         )
 
+    def qr_encoder(self, EncoderCls, stream):
+        """
+        Creates QR encoder for the stream in the host folder.
+        Encoding of big transactions takes a while, so it's shown as a loader stage.
+        """
+        if self.manager is not None:
+            self.manager.gui.show_loader(title="Encoding QR code...")
+        return EncoderCls(stream, tempfile=self.path + "/qrtmp")
+
+    async def show_qr_encoder(self, enc, title, msg="", note=None):
+        """
+        Shows animated QR code with the density stored for this format,
+        or picked automatically. Remembers density selected by the user
+        if REMEMBER_QR_DENSITY is set.
+        """
+        if not self.REMEMBER_QR_DENSITY:
+            await self.manager.gui.qr_alert(title, msg, enc, note=note, qr_width=480)
+            return
+        densities = self.settings.get("qr_density", {})
+        enc.qr_version = densities.get(enc.FORMAT)
+        await self.manager.gui.qr_alert(title, msg, enc, note=note, qr_width=480)
+        if enc.qr_version is None or enc.qr_version == densities.get(enc.FORMAT):
+            return
+        densities[enc.FORMAT] = enc.qr_version
+        self.settings["qr_density"] = densities
+        if self.parent is not None and self.parent.keystore is not None:
+            self.save_settings(self.parent.keystore)
+
     async def settings_menu(self, show_screen, keystore):
         title = self.settings_button or "Settings"
         controls = [{
@@ -108,6 +143,42 @@ class Host:
         """
         pass
 
+    def enable_wakeup(self):
+        """
+        Switches the host from polling to IRQ wakeups.
+        Call it before registering IRQ handlers that call wakeup().
+        Returns False if asyncio doesn't support it.
+        """
+        if self._wakeup is None:
+            if not hasattr(asyncio, "ThreadSafeFlag"):
+                return False
+            self._wakeup = asyncio.ThreadSafeFlag()
+        return True
+
+    def wakeup(self, *args):
+        """IRQ handler, wakes up the update loop"""
+        if self._wakeup is not None:
+            self._wakeup.set()
+
+    def pending(self):
+        """
+        Returns True if there is data left to process
+        that will not trigger another IRQ
+        """
+        return False
+
+    async def wait(self, timeout: int, poll: int = None):
+        """
+        Waits for IRQ wakeup, at most timeout ms.
+        Without IRQ wakeups just sleeps poll ms (timeout by default).
+        """
+        if self._wakeup is None:
+            return await asyncio.sleep_ms(timeout if poll is None else poll)
+        try:
+            await asyncio.wait_for_ms(self._wakeup.wait(), timeout)
+        except asyncio.TimeoutError:
+            pass
+
     async def update_loop(self, dt: int):
         while not self.enabled:
             await asyncio.sleep_ms(100)
@@ -119,9 +190,13 @@ class Host:
                     self.abort()
                     if self.manager is not None:
                         await self.manager.host_exception_handler(e)
-            # Keep await sleep here
+            # Keep await here
             # It allows other functions to run
-            await asyncio.sleep_ms(dt)
+            if self.enabled and self.pending():
+                await asyncio.sleep_ms(0)
+            else:
+                # hosts without IRQ are polled every dt ms
+                await self.wait(self.IDLE_TIMEOUT, poll=dt)
 
     def abort(self):
         """What should happen if exception?"""
@@ -148,6 +223,13 @@ class Host:
         """Implement how to get transaction from unidirectional host"""
         raise HostError("Data loading is not implemented for this class")
 
+    def release_data(self):
+        """
+        Called when the stream returned by get_data is processed.
+        Free resources used by the stream here.
+        """
+        pass
+
     async def send_psbt(self, psbt):
         """Implement how to send the signed transaction to the host"""
         raise HostError("Sending data is not implemented for this class")
@@ -2,13 +2,15 @@ from .core import Host, HostError
 import pyb
 import time
 import asyncio
-from platform import simulator, config, delete_recursively
+from platform import simulator, config
 import gc
 from gui.screens.settings import HostSettings
 from gui.screens import Alert
 from helpers import read_until, read_write, a2b_base64_stream
 from microur.decoder import FileURDecoder
 from microur.util import cbor
+import profiler
+import ramstore
 
 QRSCANNER_TRIGGER = config.QRSCANNER_TRIGGER
 # OK response from scanner
@@ -42,6 +44,10 @@ DELAY_OF_SAME_BARCODES_ADDR = b"\x00\x13"
 DELAY_OF_SAME_BARCODES = 0x85  # 5 seconds
 
 
+# BC-UR v2 progress never reaches 100% before the decoder is complete
+UR_MAX_PROGRESS = 0.99
+
+
 class QRHost(Host):
     """
     QRHost class.
@@ -52,6 +58,12 @@ class QRHost(Host):
 
     # time to wait after init
     RECOVERY_TIME = 30
+    # write parts of animated QR codes directly at their offsets in data file,
+    # falls back to per-part files if parts have different lengths
+    STREAMING_ASSEMBLY = True
+    # density choices are kept in QR scanner settings
+    # and cleared with the "Auto QR density" switch
+    REMEMBER_QR_DENSITY = True
 
     button = "Scan QR code"
     settings_button = "QR scanner"
@@ -85,6 +97,9 @@ class QRHost(Host):
             self.is_configured = True
         self.scanning = False
         self.parts = None
+        self.num_parts = 0
+        # bitmap of received parts
+        self.received = None
         self.raw = False
         self.chunk_timeout = 0.5
 
@@ -191,6 +206,17 @@ class QRHost(Host):
         return True
 
     def init(self):
+        self._init()
+        self._enable_irq()
+
+    def _enable_irq(self):
+        """Wakes up the update loop when the scanner is done sending data"""
+        if simulator or not hasattr(self.uart, "irq"):
+            return
+        if self.enable_wakeup():
+            self.uart.irq(handler=self.wakeup, trigger=pyb.UART.IRQ_RXIDLE)
+
+    def _init(self):
         if self.is_configured:
             return
         # if failed to configure - probably a different scanner
@@ -234,19 +260,27 @@ class QRHost(Host):
             "label": "Flashlight",
             "hint": "Can create blicks on the screen",
             "value": self.settings.get("light", False)
+        }, {
+            "label": "Auto QR density",
+            "hint": "Pick density of animated QR codes automatically and forget manual choices",
+            "value": not self.settings.get("qr_density")
         }]
         scr = HostSettings(controls, title=title)
         res = await show_screen(scr)
         if res:
-            enabled, sound, aim, light = res
-            self.settings = {
+            enabled, sound, aim, light, auto_density = res
+            self.settings.update({
                 "enabled": enabled,
                 "aim": aim,
                 "light": light,
                 "sound": sound,
-            }
+            })
+            if auto_density:
+                self.settings.pop("qr_density", None)
             self.save_settings(keystore)
             self.configure()
+            # uart is reinitialized by configure()
+            self._enable_irq()
             await show_screen(Alert("Success!", "\n\nSettings updated!", button_text="Close"))
 
     def clean_uart(self):
@@ -264,6 +298,8 @@ class QRHost(Host):
             self.trigger.off()
         else:
             self.set_setting(SCAN_ADDR, 1)
+        # update loop should notice that scanning started
+        self.wakeup()
 
     async def _restart_scanner(self):
         if self.trigger is not None:
@@ -278,7 +314,7 @@ class QRHost(Host):
         self._stop_scanner()
 
     def abort(self):
-        with open(self.tmpfile,"wb"):
+        with ramstore.open(self.tmpfile,"wb"):
             pass
         self.cancelled = True
         self.stop_scanning()
@@ -287,12 +323,16 @@ class QRHost(Host):
     def tmpfile(self):
         return self.path+"/tmp"
 
+    @property
+    def datafile(self):
+        return self.path+"/data.txt"
+
     async def scan(self, raw=True, chunk_timeout=0.5):
         self.raw = raw
         self.chunk_timeout = chunk_timeout
         self._start_scanner()
         # clear the data
-        with open(self.tmpfile,"wb") as f:
+        with ramstore.open(self.tmpfile,"wb") as f:
             pass
         if self.f is not None:
             self.f.close()
@@ -301,6 +341,8 @@ class QRHost(Host):
         self.cancelled = False
         self.animated = False
         self.parts = None
+        self.num_parts = 0
+        self.received = None
         self.bcur = False
         self.bcur2 = False
         self.decoder = FileURDecoder(self.path)
@@ -314,12 +356,13 @@ class QRHost(Host):
         if self.parts is not None:
             del self.parts
             self.parts = None
+        self.last_part = None
         del self.decoder
         self.decoder = None
         gc.collect()
         if self.cancelled:
             return None
-        self.f = open(self.path+"/data.txt", "rb")
+        self.f = ramstore.open(self.datafile, "rb")
         return self.f
 
     def check_animated(self, data: bytes):
@@ -336,6 +379,28 @@ class QRHost(Host):
             return False
         return False
 
+    async def read_code(self):
+        """
+        Reads the first QR code from uart.
+        Without IRQ waits chunk_timeout for all data to come,
+        with IRQ only until the end of line arrives.
+        """
+        if self._wakeup is None:
+            await asyncio.sleep(self.chunk_timeout)
+            return self.uart.read()
+        d = b""
+        timeout = int(self.chunk_timeout * 1000)
+        t0 = time.ticks_ms()
+        while True:
+            d += self.uart.read() or b""
+            left = timeout - time.ticks_diff(time.ticks_ms(), t0)
+            if d[-len(self.EOL):] == self.EOL or left <= 0:
+                return d
+            await self.wait(left)
+
+    def pending(self):
+        return self.scanning and self.uart.any() > 0
+
     async def update(self):
         if not self.scanning:
             self.clean_uart()
@@ -344,15 +409,14 @@ class QRHost(Host):
         if self.uart.any() > 0:
             if not self.animated: # read only one QR code
                 # let all data to come on the first QR code
-                await asyncio.sleep(self.chunk_timeout)
-                d = self.uart.read()
+                d = await self.read_code()
                 # if not animated -> stop and return
                 if not self.check_animated(d):
                     if d[-len(self.EOL):] == self.EOL:
                         d = d[:-len(self.EOL)]
                     self._stop_scanner()
-                    fname = self.path + "/data.txt"
-                    with open(fname, "wb") as fout:
+                    fname = self.datafile
+                    with ramstore.open(fname, "wb") as fout:
                         fout.write(d)
                     self.stop_scanning()
                     return
@@ -361,14 +425,14 @@ class QRHost(Host):
                 d = self.uart.read()
             # no new lines - just write and continue
             if d[-len(self.EOL):] != self.EOL:
-                with open(self.tmpfile,"ab") as f:
+                with ramstore.open(self.tmpfile,"ab") as f:
                     f.write(d)
                 return
             # restart scan while processing data
             await self._restart_scanner()
             # slice to write
             d = d[:-len(self.EOL)]
-            with open(self.tmpfile,"ab") as f:
+            with ramstore.open(self.tmpfile,"ab") as f:
                 f.write(d)
             try:
                 if self.process_chunk():
@@ -377,13 +441,13 @@ class QRHost(Host):
                 self.stop_scanning()
                 raise e
             # erase the content of the file
-            with open(self.tmpfile, "wb") as f:
+            with ramstore.open(self.tmpfile, "wb") as f:
                 pass
 
     def process_chunk(self):
         """Returns true when scanning complete"""
         # should not be there if trigger mode or simulator
-        with open(self.tmpfile, "rb") as f:
+        with ramstore.open(self.tmpfile, "rb") as f:
             c = f.read(len(SUCCESS))
             while c == SUCCESS:
                 c = f.read(len(SUCCESS))
@@ -402,13 +466,14 @@ class QRHost(Host):
                 return self.process_normal(f)
 
     def process_bcur2(self, f):
+        # repeated and redundant parts are handled by the decoder
         gc.collect()
         if self.decoder.read_part(f):
             self._stop_scanner()
-            fname = self.path + "/data.txt"
+            fname = self.datafile
             with self.decoder.result() as b:
                 msglen = cbor.read_bytes_len(b)
-                with open(fname, "wb") as fout:
+                with ramstore.open(fname, "wb") as fout:
                     read_write(b, fout)
             gc.collect()
             return True
@@ -429,8 +494,8 @@ class QRHost(Host):
         if char is None or b"OF" not in chunk.upper():
             if not self.animated:
                 # maybe there is a hash, but no parts
-                fname = self.path + "/data.txt"
-                with open(fname, "wb") as fout:
+                fname = self.datafile
+                with ramstore.open(fname, "wb") as fout:
                     fout.write(b"UR:BYTES/")
                     fout.write(chunk)
                     fout.write(char or b"")
@@ -447,44 +512,22 @@ class QRHost(Host):
         if not self.animated:
             try:
                 m, n = self.parse_prefix(prefix)
-                # if succeed - first animated frame,
-                # allocate stuff
-                self.animated = True
-                self.parts = [None] * n
-                fname = "%s/p%d.txt" % (self.path, m-1)
-                with open(fname, "wb") as fout:
-                    read_write(f, fout)
-                self.parts[m - 1] = fname
-                self.bcur_hash = hsh
-                return False
             # failed - not animated, just unfortunately similar data
             except:
                 raise HostError("Ivalid QR code part encoding: %r" % chunk)
+            # if succeed - first animated frame,
+            # allocate stuff
+            self.bcur_hash = hsh
+            self.start_parts(n, header=b"UR:BYTES/" + hsh + b"/")
+            return self.add_part(m, f.read())
         # expecting animated frame
         m, n = self.parse_prefix(prefix)
-        if n != len(self.parts):
+        if n != self.num_parts:
             raise HostError("Invalid prefix")
         if hsh != self.bcur_hash:
             print(hsh, self.bcur_hash)
             raise HostError("Checksum mismatch")
-        fname = "%s/p%d.txt" % (self.path, m-1)
-        with open(fname, "wb") as fout:
-            fout.write(f.read())
-        self.parts[m - 1] = fname
-        # all have non-zero len
-        if None not in self.parts:
-            self._stop_scanner()
-            fname = self.path + "/data.txt"
-            with open(fname, "wb") as fout:
-                fout.write(b"UR:BYTES/")
-                fout.write(self.bcur_hash)
-                fout.write(b"/")
-                for part in self.parts:
-                    with open(part, "rb") as fp:
-                        read_write(fp, fout)
-            return True
-        else:
-            return False
+        return self.add_part(m, f.read())
 
     def process_normal(self, f):
         # check if it starts with pMofN
@@ -492,8 +535,8 @@ class QRHost(Host):
         chunk = chunk or b""
         if char is None:
             if not self.animated:
-                fname = self.path + "/data.txt"
-                with open(fname, "wb") as fout:
+                fname = self.datafile
+                with ramstore.open(fname, "wb") as fout:
                     fout.write(chunk)
                     read_write(f, fout)
                 return True
@@ -502,52 +545,124 @@ class QRHost(Host):
                 raise HostError("Ivalid QR code part encoding: %r" % chunk)
         # space is there
         if not self.animated:
+            m = None
             if chunk.startswith(b"p") and b"of" in chunk:
                 try:
                     m, n = self.parse_prefix(chunk)
-                    # if succeed - first animated frame,
-                    # allocate stuff
-                    self.animated = True
-                    self.parts = [None] * n
-                    fname = "%s/p%d.txt" % (self.path, m-1)
-                    with open(fname, "wb") as fout:
-                        read_write(f, fout)
-                    self.parts[m - 1] = fname
-                    return False
                 # failed - not animated, just unfortunately similar data
                 except:
-                    fname = self.path + "/data.txt"
-                    with open(fname, "wb") as fout:
-                        fout.write(chunk)
-                        fout.write(char)
-                        read_write(f, fout)
-                    return True
-            else:
-                fname = self.path + "/data.txt"
-                with open(fname, "wb") as fout:
+                    pass
+            if m is None:
+                with ramstore.open(self.datafile, "wb") as fout:
                     fout.write(chunk)
                     fout.write(char)
                     read_write(f, fout)
                 return True
+            # if succeed - first animated frame,
+            # allocate stuff
+            self.start_parts(n)
+            return self.add_part(m, f.read())
         # expecting animated frame
         m, n = self.parse_prefix(chunk)
-        if n != len(self.parts):
+        if n != self.num_parts:
             raise HostError("Invalid prefix")
-        fname = "%s/p%d.txt" % (self.path, m-1)
-        with open(fname, "wb") as fout:
-            read_write(f, fout)
-        self.parts[m - 1] = fname
-        # all have non-zero len
-        if None not in self.parts:
-            self._stop_scanner()
-            fname = self.path + "/data.txt"
-            with open(fname, "wb") as fout:
+        return self.add_part(m, f.read())
+
+    def start_parts(self, n, header=b""):
+        """
+        Allocates state for animated QR code with n parts.
+        Header is written to the data file before the first part.
+        """
+        self.animated = True
+        self.num_parts = n
+        self.received = bytearray((n + 7) // 8)
+        self.received_count = 0
+        self.streaming = self.STREAMING_ASSEMBLY
+        self.parts = None if self.streaming else [None] * n
+        self.header = header
+        # length of all parts except the last one
+        self.part_len = None
+        self.last_len = None
+        # last part received before we know part length
+        self.last_part = None
+        with ramstore.open(self.datafile, "wb") as fout:
+            fout.write(header)
+
+    def has_part(self, i):
+        return bool(self.received[i // 8] & (1 << (i % 8)))
+
+    def add_part(self, m, data):
+        """
+        Stores part m (1-indexed) of animated QR code.
+        Returns True when all parts are received and data file is ready.
+        """
+        i = m - 1
+        if self.has_part(i):
+            return False
+        if self.streaming and not self._place_part(i, data):
+            self._split_parts()
+        if not self.streaming:
+            fname = "%s/p%d.txt" % (self.path, i)
+            with ramstore.open(fname, "wb") as fout:
+                fout.write(data)
+            self.parts[i] = fname
+        self.received[i // 8] |= 1 << (i % 8)
+        self.received_count += 1
+        if self.received_count < self.num_parts:
+            return False
+        self._stop_scanner()
+        # per-part files are concatenated only in fallback mode
+        if not self.streaming:
+            with ramstore.open(self.datafile, "wb") as fout:
+                fout.write(self.header)
                 for part in self.parts:
-                    with open(part, "rb") as fp:
+                    with ramstore.open(part, "rb") as fp:
                         read_write(fp, fout)
-            return True
-        else:
+        return True
+
+    def _place_part(self, i, data):
+        """
+        Writes part i at its final offset in the data file.
+        Returns False if parts don't have the same length.
+        """
+        last = (i == self.num_parts - 1)
+        if self.part_len is None:
+            # last part can be shorter - wait for another one
+            if last and self.num_parts > 1:
+                self.last_part = data
+                return True
+            self.part_len = len(data)
+            if self.last_part is not None:
+                if not self._place_part(self.num_parts - 1, self.last_part):
+                    return False
+                self.last_part = None
+        if len(data) > self.part_len or (not last and len(data) != self.part_len):
             return False
+        with ramstore.open(self.datafile, "r+b") as fout:
+            fout.seek(len(self.header) + i * self.part_len)
+            fout.write(data)
+        if last:
+            self.last_len = len(data)
+        return True
+
+    def _split_parts(self):
+        """Moves already received parts to per-part files"""
+        n = self.num_parts
+        self.parts = [None] * n
+        with ramstore.open(self.datafile, "rb") as fin:
+            for j in range(n):
+                if not self.has_part(j):
+                    continue
+                fname = "%s/p%d.txt" % (self.path, j)
+                with ramstore.open(fname, "wb") as fout:
+                    if j == n - 1 and self.last_part is not None:
+                        fout.write(self.last_part)
+                    else:
+                        fin.seek(len(self.header) + j * self.part_len)
+                        fout.write(fin.read(self.last_len if j == n - 1 else self.part_len))
+                self.parts[j] = fname
+        self.last_part = None
+        self.streaming = False
 
     def parse_prefix(self, prefix: bytes):
         print(prefix)
@@ -561,7 +676,7 @@ class QRHost(Host):
         return m, n
 
     async def get_data(self, raw=True, chunk_timeout=0.5):
-        delete_recursively(self.path)
+        ramstore.delete_recursively(self.path)
         if self.manager is not None:
             # pass self so user can abort
             await self.manager.gui.show_progress(
@@ -569,21 +684,25 @@ class QRHost(Host):
             )
         stream = await self.scan(raw=raw, chunk_timeout=chunk_timeout)
         if stream is not None:
+            if profiler.ENABLED:
+                cur = stream.tell()
+                profiler.count_io("qr", read=stream.seek(0, 2) - cur)
+                stream.seek(cur)
             return stream
 
     async def send_data(self, stream, meta, *args, **kwargs):
         # if it's str - it's a file
         if isinstance(stream, str):
-            with open(stream, "rb") as f:
+            with ramstore.open(stream, "rb") as f:
                 return await self.send_data(f, meta, *args, **kwargs)
         title = meta.get("title", "Your data:")
         note = meta.get("note")
         start = stream.read(4)
         stream.seek(-len(start), 1)
         if start in [b"cHNi", b"cHNl"]: # convert from base64 for QR encoder
-            with open(self.tmpfile, "wb") as f:
+            with ramstore.open(self.tmpfile, "wb") as f:
                 a2b_base64_stream(stream, f)
-            with open(self.tmpfile, "rb") as f:
+            with ramstore.open(self.tmpfile, "rb") as f:
                 return await self.send_data(f, meta, *args, **kwargs)
 
         if start not in [b"psbt", b"pset"]:
@@ -598,8 +717,8 @@ class QRHost(Host):
             from qrencoder import LegacyBCUREncoder as EncoderCls
         else:
             from qrencoder import Base64QREncoder as EncoderCls
-        with EncoderCls(stream, tempfile=self.path+"/qrtmp") as enc:
-            await self.manager.gui.qr_alert(title, "", enc, note=note, qr_width=480)
+        with self.qr_encoder(EncoderCls, stream) as enc:
+            await self.show_qr_encoder(enc, title, note=note)
 
     @property
     def in_progress(self):
@@ -613,9 +732,11 @@ class QRHost(Host):
         - or a list of True False for checkboxes
         """
         if self.bcur2 and self.decoder:
-            return self.decoder.progress
+            if self.decoder.is_complete():
+                return 1
+            return min(self.decoder.progress, UR_MAX_PROGRESS)
         if not self.in_progress:
             return 1
         if not self.animated:
             return 0
-        return [part is not None for part in self.parts]
+        return [self.has_part(i) for i in range(self.num_parts)]
@@ -1,9 +1,62 @@
 from .core import Host, HostError
-from platform import fpath
+from platform import fpath, acquire_preallocated_buffer, release_preallocated_ram
 import os
 import platform
 from binascii import hexlify
 from helpers import a2b_base64_stream
+import profiler
+import ramstore
+
+
+class PrefixedStream:
+    """
+    Read-only stream returning prefix followed by the content of the file.
+    Bytes read from the file are counted by the profiler.
+    """
+
+    def __init__(self, prefix, f):
+        self.prefix = prefix
+        self.f = f
+        self.start = f.tell()
+        self.pos = 0
+
+    def read(self, n=-1):
+        res = b""
+        plen = len(self.prefix)
+        if self.pos < plen:
+            end = plen if n < 0 else min(plen, self.pos + n)
+            res = self.prefix[self.pos:end]
+            self.pos = end
+            if n >= 0:
+                n -= len(res)
+                if n == 0:
+                    return res
+        chunk = self.f.read() if n < 0 else self.f.read(n)
+        self.pos += len(chunk)
+        profiler.count_io("sd", read=len(chunk))
+        return res + chunk
+
+    def readinto(self, buf):
+        data = self.read(len(buf))
+        buf[:len(data)] = data
+        return len(data)
+
+    def seek(self, offset, whence=0):
+        plen = len(self.prefix)
+        if whence == 1:
+            offset += self.pos
+        elif whence == 2:
+            offset += self.f.seek(0, 2) - self.start + plen
+        self.pos = max(offset, 0)
+        self.f.seek(self.start + max(self.pos - plen, 0))
+        return self.pos
+
+    def tell(self):
+        return self.pos
+
+    def close(self):
+        self.f.close()
+
 
 class SDHost(Host):
     """
@@ -15,6 +68,12 @@ class SDHost(Host):
 
     button = "Open SD card file"
     settings_button = "SD card"
+    # copy buffer size, taken from preallocated RAM
+    COPY_CHUNK = 0x8000
+    # heap buffer size if preallocated RAM is used by someone else
+    HEAP_CHUNK = 0x1000
+    # parse requests directly from SD card instead of copying to ramdisk
+    DIRECT_READ = True
 
     def __init__(self, path, sdpath=fpath("/sd")):
         super().__init__(path)
@@ -22,23 +81,53 @@ class SDHost(Host):
         self.f = None
         self.fram = self.path + "/data"
         self.sd_file = self.sdpath + "/signed.psbt"
+        # True if self.f is a file on the SD card
+        self.direct = False
 
-    def reset_and_mount(self):
+    def init(self):
+        # SD card is only used on user request, nothing to poll
+        self.enable_wakeup()
+
+    def release_data(self):
         if self.f is not None:
             self.f.close()
-            os.remove(self.fram)
+            if not self.direct:
+                ramstore.remove(self.fram)
             self.f = None
+        # card stays mounted only while we read from it directly,
+        # in all other cases get_data and send_data unmount it
+        if self.direct:
+            self.direct = False
+            platform.sdcard.unmount()
+
+    def reset_and_mount(self):
+        self.release_data()
         if not platform.sdcard.is_present:
             raise HostError("SD card is not inserted")
         platform.sdcard.mount()
 
     def copy(self, fin, fout):
-        b = bytearray(100)
-        while True:
-            l = fin.readinto(b)
-            if l == 0:
-                break
-            fout.write(b, l)
+        """
+        Copies using a large buffer from preallocated RAM, returns number of bytes.
+        Falls back to a small heap buffer if preallocated RAM is busy.
+        """
+        buf = acquire_preallocated_buffer(self)
+        try:
+            if buf is None:
+                buf = memoryview(bytearray(self.HEAP_CHUNK))
+            else:
+                buf = buf[:self.COPY_CHUNK]
+            total = 0
+            with profiler.span("sd.copy"):
+                while True:
+                    l = fin.readinto(buf)
+                    if not l:
+                        break
+                    fout.write(buf[:l])
+                    total += l
+            return total
+        finally:
+            release_preallocated_ram(self)
 
     async def get_data(self, raw=False, chunk_timeout=0.1):
         """
@@ -50,17 +139,30 @@ class SDHost(Host):
             if sd_file is None:
                 return
             self.sd_file = sd_file
-            with open(self.fram, "wb") as fout:
+            if self.DIRECT_READ:
+                fin = open(self.sd_file, "rb")
+                # check sign prefix for txs
+                start = fin.read(5)
+                fin.seek(0)
+                prefix = b""
+                if self.sd_file.endswith(".psbt") and start != b"sign ":
+                    prefix = b"sign "
+                self.f = PrefixedStream(prefix, fin)
+                self.direct = True
+                return self.f
+            with ramstore.open(self.fram, "wb") as fout:
                 with open(self.sd_file, "rb") as fin:
                     # check sign prefix for txs
                     start = fin.read(5)
                     if self.sd_file.endswith(".psbt") and start != b"sign ":
                         fout.write(b"sign ")
                     fout.write(start)
-                    self.copy(fin, fout)
-            self.f = open(self.fram,"rb")
+                    profiler.count_io("sd", read=len(start) + self.copy(fin, fout))
+            self.f = ramstore.open(self.fram,"rb")
         finally:
-            platform.sdcard.unmount()
+            # keep the card mounted for direct reading
+            if not self.direct:
+                platform.sdcard.unmount()
         return self.f
 
     def truncate(self, fname):
@@ -128,12 +230,12 @@ class SDHost(Host):
                     platform.sdcard.unmount()
                     return
             if isinstance(stream, str):
-                with open(stream, "rb") as fin:
+                with ramstore.open(stream, "rb") as fin:
                     with open(new_fname, "wb") as fout:
-                        self.copy(fin, fout)
+                        profiler.count_io("sd", written=self.copy(fin, fout))
             else:
                 with open(new_fname, "wb") as fout:
-                    self.copy(stream, fout)
+                    profiler.count_io("sd", written=self.copy(stream, fout))
                 stream.seek(0)
         finally:
             platform.sdcard.unmount()
@@ -148,16 +250,16 @@ class SDHost(Host):
     async def _show_qr(self, stream, meta, *args, **kwargs):
         # if it's str - it's a file
         if isinstance(stream, str):
-            with open(stream, "rb") as f:
+            with ramstore.open(stream, "rb") as f:
                 await self._show_qr(f, meta, *args, **kwargs)
             return
         qrfmt = 1 # always offer simple text animation for qr codes
         start = stream.read(4)
         stream.seek(-len(start), 1)
         if start in [b"cHNi", b"cHNl"]: # convert from base64 for QR encoder
-            with open(self.tmpfile, "wb") as f:
+            with ramstore.open(self.tmpfile, "wb") as f:
                 a2b_base64_stream(stream, f)
-            with open(self.tmpfile, "rb") as f:
+            with ramstore.open(self.tmpfile, "rb") as f:
                 await self._show_qr(f, meta, *args, **kwargs)
                 return
         if start in [b"psbt", b"pset"]:
@@ -183,5 +285,5 @@ class SDHost(Host):
         elif qrfmt == 3:
             from qrencoder import LegacyBCUREncoder as EncoderCls
         if EncoderCls is not None:
-            with EncoderCls(stream, tempfile=self.path+"/qrtmp") as enc:
-                await self.manager.gui.qr_alert(title, msg, enc, note=note, qr_width=480)
+            with self.qr_encoder(EncoderCls, stream) as enc:
+                await self.show_qr_encoder(enc, title, msg, note=note)
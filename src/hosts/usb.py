@@ -2,8 +2,12 @@ from errors import BaseError
 from .core import Host, HostError
 import sys
 import pyb
+import time
 import asyncio
 import platform
+import profiler
+import ramstore
+from io import BytesIO
 
 
 class USBHost(Host):
@@ -15,6 +19,17 @@ class USBHost(Host):
     ACK = b"ACK\r\n"
     RECOVERY_TIME = 10
     settings_button = "USB communication"
+    # binary upload: "upload <len>" line followed by <len> raw bytes
+    UPLOAD_PREFIX = b"upload "
+    UPLOAD_CHUNK = 4096
+    # max size of the binary upload
+    UPLOAD_LIMIT = 0x400000
+    # abort upload if no data arrived for so long, ms
+    UPLOAD_TIMEOUT = 3000
+    # block size for responses
+    SEND_CHUNK = 4096
+    # dumps profiler records, "profile clear" resets them
+    PROFILE_COMMAND = b"profile"
 
     def __init__(self, path):
         super().__init__(path)
@@ -22,6 +37,14 @@ class USBHost(Host):
         self.settings = { "enabled": False }
         self.usb = None
         self.f = None
+        # data received after EOL of the upload line
+        self.tail = b""
+        # first bytes of the current line to detect upload command
+        self.head = b""
+        # upload line ended with \r at the end of the read, \n may follow
+        self.skip_lf = False
+        # send length header with the response (binary upload requests)
+        self.length_header = False
 
     def init(self):
         # doesn't work if it was enabled and then disabled
@@ -30,6 +53,9 @@ class USBHost(Host):
             self.usb.init(flow=(pyb.USB_VCP.RTS | pyb.USB_VCP.CTS))
             if platform.simulator:
                 print("Connect to 127.0.0.1:8789 to do USB communication")
+            # wake up on received packets instead of polling
+            elif hasattr(self.usb, "irq") and self.enable_wakeup():
+                self.usb.irq(handler=self.wakeup, trigger=pyb.USB_VCP.IRQ_RX)
 
     def load_settings(self, *args, **kwargs):
         super().load_settings(*args, **kwargs)
@@ -57,11 +83,17 @@ class USBHost(Host):
             # reboot required
             return True
 
+    def pending(self):
+        # line is read in small chunks, the rest is already in the buffer
+        return self.usb is not None and bool(self.usb.any())
+
     def cleanup(self):
         if self.f is not None:
             self.f.close()
             self.f = None
-        platform.delete_recursively(self.path)
+        self.skip_lf = False
+        self.tail = b""
+        ramstore.delete_recursively(self.path)
 
     async def process_command(self, stream):
         if self.manager is None:
@@ -71,6 +103,12 @@ class USBHost(Host):
         # if empty command - return \r\n back
         if len(b) == 0:
             return self.respond(b"")
+        if b.startswith(self.PROFILE_COMMAND):
+            # timings and heap usage are only for the unlocked device
+            keystore = self.manager.keystore
+            if keystore is None or keystore.is_locked:
+                raise HostError("Device is locked")
+            return await self.send_profile(b)
         # rewind
         stream.seek(0)
         # res should be a stream as well
@@ -83,18 +121,57 @@ class USBHost(Host):
             stream, meta = res
             # if it's str - it's a filename
             if isinstance(stream, str):
-                with open(stream, "rb") as f:
-                    self._send_data(f)
+                with ramstore.open(stream, "rb") as f:
+                    await self._send_data(f, self.length_header)
             else:
-                self._send_data(stream)
+                await self._send_data(stream, self.length_header)
+
+    async def send_profile(self, cmd):
+        if not profiler.ENABLED:
+            raise HostError("Profiler is disabled")
+        if cmd.strip() == self.PROFILE_COMMAND + b" clear":
+            profiler.clear()
+            return self.respond(b"success")
+        out = BytesIO()
+        profiler.dump(out)
+        out.seek(0)
+        await self._send_data(out, self.length_header)
 
-    def _send_data(self, stream):
+    async def _send_data(self, stream, length_header=False):
+        """
+        Streams the response in SEND_CHUNK blocks,
+        yields to the event loop between blocks so GUI stays responsive.
+        With length_header a "length <n>" line is sent first.
+        """
+        if length_header:
+            cur = stream.tell()
+            size = stream.seek(0, 2) - cur
+            stream.seek(cur)
+            await self._write_all(b"length %d\r\n" % size)
+        buf = bytearray(self.SEND_CHUNK)
+        mv = memoryview(buf)
         # loop until we read everything
-        chunk = stream.read(32)
-        while len(chunk) > 0:
-            self.usb.write(chunk)
-            chunk = stream.read(32)
-        self.respond(b"")
+        n = stream.readinto(buf)
+        while n:
+            await self._write_all(mv[:n])
+            await asyncio.sleep_ms(0)
+            n = stream.readinto(buf)
+        await self._write_all(b"\r\n")
+
+    async def _write_all(self, data):
+        """Writes data waiting for the host to read if the buffer is full"""
+        off = 0
+        t0 = time.ticks_ms()
+        while off < len(data):
+            n = self.usb.write(data[off:])
+            if not n:
+                if time.ticks_diff(time.ticks_ms(), t0) > self.UPLOAD_TIMEOUT:
+                    raise HostError("Send timeout")
+                await asyncio.sleep_ms(1)
+                continue
+            off += n
+            profiler.count_io("usb", written=n)
+            t0 = time.ticks_ms()
 
     def respond(self, data):
         self.usb.write(data)
@@ -111,10 +188,18 @@ class USBHost(Host):
         # if we didn't get anything - return
         if res is None or len(res) == 0:
             return
+        profiler.count_io("usb", read=len(res))
         # check if we already have something
         # if not - create new file on the ramdisk
         if self.f is None:
-            self.f = open(self.path + "/data", "wb")
+            self.f = ramstore.open(self.path + "/data", "wb")
+            self.head = b""
+        # upload line is followed by raw binary data,
+        # it must not go through EOL parsing below
+        if len(self.head) < len(self.UPLOAD_PREFIX):
+            self.head += res[:len(self.UPLOAD_PREFIX) - len(self.head)]
+        if self.head == self.UPLOAD_PREFIX:
+            return self.read_upload_line(res)
         # check if we dont have EOL in the data
         if b"\n" not in res and b"\r" not in res:
             self.f.write(res)
@@ -129,7 +214,7 @@ class USBHost(Host):
                 arr = res.split(eol * 2)
                 # cleanup and start over
                 self.cleanup()
-                self.f = open(self.path + "/data", "wb")
+                self.f = ramstore.open(self.path + "/data", "wb")
                 # this is the part we care about
                 res = arr[-1]
                 # if command is not complete yet
@@ -143,11 +228,83 @@ class USBHost(Host):
         # only one command at a time is allowed,
         # throw everything else away
         self.f.write(arr[0])
+        self.tail = b""
         # close file
         self.f.close()
         self.f = None
         return self.path + "/data"
 
+    def read_upload_line(self, res):
+        """
+        Reads upload command line until the first EOL,
+        everything after it is kept in the tail unchanged
+        """
+        idxs = [res.find(c) for c in [b"\r", b"\n"] if c in res]
+        if not idxs:
+            self.f.write(res)
+            return
+        i = min(idxs)
+        end = i + 1
+        if res[i:i + 2] == b"\r\n":
+            end = i + 2
+        self.skip_lf = (end == len(res) and res[i:end] == b"\r")
+        self.f.write(res[:i])
+        self.tail = res[end:]
+        self.f.close()
+        self.f = None
+        return self.path + "/data"
+
+    def get_upload_size(self, fname):
+        """Returns the size of binary upload if the line is an upload command"""
+        with ramstore.open(fname, "rb") as f:
+            line = f.read(len(self.UPLOAD_PREFIX) + 12)
+        if not line.startswith(self.UPLOAD_PREFIX):
+            return None
+        try:
+            size = int(line[len(self.UPLOAD_PREFIX):].strip())
+        except:
+            raise HostError("Invalid upload size")
+        if size <= 0 or size > self.UPLOAD_LIMIT:
+            raise HostError("Invalid upload size")
+        return size
+
+    async def read_upload(self, size):
+        """
+        Reads size bytes of raw data to the ramdisk file.
+        No EOL parsing and no sleeps while data keeps coming.
+        """
+        buf = bytearray(self.UPLOAD_CHUNK)
+        mv = memoryview(buf)
+        left = size
+        with ramstore.open(self.path + "/data", "wb") as f:
+            # data that arrived together with the upload line
+            tail = self.tail[:left]
+            self.tail = b""
+            f.write(tail)
+            left -= len(tail)
+            t0 = time.ticks_ms()
+            while left > 0:
+                n = self.usb.readinto(buf, min(left, len(buf)))
+                if not n:
+                    if time.ticks_diff(time.ticks_ms(), t0) > self.UPLOAD_TIMEOUT:
+                        raise HostError("Upload timeout")
+                    # let the host send more
+                    await self.wait(100, poll=1)
+                    continue
+                # \n of the \r\n line ending that came with the next read
+                if self.skip_lf:
+                    self.skip_lf = False
+                    if buf[0] == 0x0A:
+                        buf[:n - 1] = buf[1:n]
+                        n -= 1
+                        if n == 0:
+                            continue
+                f.write(mv[:n])
+                profiler.count_io("usb", read=n)
+                left -= n
+                t0 = time.ticks_ms()
+        return self.path + "/data"
+
     async def update(self):
         if self.manager is None:
             return await asyncio.sleep_ms(100)
@@ -162,7 +319,13 @@ class USBHost(Host):
             self.usb.write(self.ACK)
             # open again for reading and try to process content
             try:
-                with open(self.path + "/data", "rb") as f:
+                size = self.get_upload_size(res)
+                self.length_header = size is not None
+                if size is not None:
+                    res = await self.read_upload(size)
+                    # upload received, processing the content
+                    self.usb.write(self.ACK)
+                with ramstore.open(res, "rb") as f:
                     await self.process_command(f)
             # if we fail with our own error type
             # tell the host why we failed
@@ -177,6 +340,3 @@ class USBHost(Host):
                 else:
                     self.respond(b"error: Unknown error")
             self.cleanup()
-
-        # wait a bit
-        await asyncio.sleep_ms(10)
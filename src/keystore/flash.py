@@ -50,7 +50,7 @@ class FlashKeyStore(RAMKeyStore):
         """Verify file and load PIN state from it"""
         # If PIN file doesn't exist - create it
         # This can happen if the device was initialized with the smartcard
-        if not platform.file_exists(self.path + "/pin"):
+        if not platform.recover_file(self.path + "/pin"):
             self.create_empty_pin_file()
             return
         try:
@@ -141,7 +141,7 @@ class FlashKeyStore(RAMKeyStore):
 
     def load_enc_secret(self):
         fpath = self.path + "/enc_secret"
-        if platform.file_exists(fpath):
+        if platform.recover_file(fpath):
             _, secret = self.load_aead(fpath, self.pin_secret)
         else:
             # create new key if it doesn't exist
@@ -151,6 +151,7 @@ class FlashKeyStore(RAMKeyStore):
 
     def lock(self):
         """Locks the keystore, requires PIN to unlock"""
+        self.clear_derivation_cache()
         self._is_locked = True
         return self.is_locked
 
@@ -260,7 +261,7 @@ class FlashKeyStore(RAMKeyStore):
             if file is None:
                 return False
 
-        if not platform.file_exists(file):
+        if not platform.recover_file(file):
             raise KeyStoreError("Key is not saved")
         _, data = self.load_aead(file, self.enc_secret)
 
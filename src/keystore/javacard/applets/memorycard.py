@@ -12,7 +12,7 @@ class MemoryCardApplet(SecureApplet):
         super().__init__(connection, aid)
 
     def save_secret(self, secret: bytes):
-        return self.sc.request(self.SET_SECRET + secret)
+        return self.sc.request(self.SET_SECRET + secret, resume=False)
 
     def get_secret(self):
         return self.sc.request(self.GET_SECRET)
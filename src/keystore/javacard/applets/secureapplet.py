@@ -84,7 +84,7 @@ class SecureApplet(Applet):
             raise AppletException("PIN is already set")
         # we always set sha256(pin) so it's constant length
         h = hashlib.sha256(pin.encode()).digest()
-        self.sc.request(self.SET_PIN + h)
+        self.sc.request(self.SET_PIN + h, resume=False)
         # update status
         self.get_pin_status()
 
@@ -95,7 +95,7 @@ class SecureApplet(Applet):
             raise AppletException("Unlock the card first")
         h1 = hashlib.sha256(old_pin.encode()).digest()
         h2 = hashlib.sha256(new_pin.encode()).digest()
-        self.sc.request(self.CHANGE_PIN + encode(h1) + encode(h2))
+        self.sc.request(self.CHANGE_PIN + encode(h1) + encode(h2), resume=False)
         # update status
         self.get_pin_status()
 
@@ -108,10 +108,15 @@ class SecureApplet(Applet):
         try:
             # we always set sha256(pin) so it's constant length
             h = hashlib.sha256(pin.encode()).digest()
-            self.sc.request(self.UNLOCK + h)
-        finally:
-            # update status
+            self.sc.request(self.UNLOCK + h, resume=False)
+        except Exception as e:
+            # update status - attempts counter changed
             self.get_pin_status()
+            raise e
+        # successful unlock resets the counter,
+        # no need to ask the card
+        self._pin_status = self.PIN_UNLOCKED
+        self._pin_attempts_left = self._pin_attempts_max
 
     def lock(self):
         self.sc.request(self.LOCK)
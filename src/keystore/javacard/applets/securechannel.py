@@ -5,6 +5,7 @@ from io import BytesIO
 from rng import get_random_bytes
 from ucryptolib import aes
 from binascii import hexlify
+from .applet import ISOException
 
 AES_BLOCK = 16
 IV_SIZE = 16
@@ -28,6 +29,9 @@ class SecureChannelError(Exception):
 class SecureChannel:
     """
     Class that implements secure communication with the card.
+    Once opened the session is reused by all following requests
+    and is reestablished only if the card doesn't recognize it anymore
+    (i.e. after reset or reinsertion).
     """
 
     GET_PUBKEY = b"\xB0\xB2\x00\x00"
@@ -36,6 +40,9 @@ class SecureChannel:
     SECURE_MSG = b"\xB0\xB6\x00\x00"
     CLOSE = b"\xB0\xB7\x00\x00"
     SUCCESS = b"\x90\x00"
+    # status words of a secure message rejected because the card
+    # has no session (reset, reinsertion or channel closed)
+    SESSION_LOST = ["6985", "6982"]
 
     def __init__(self, applet):
         """Pass Card or Simulator instance here"""
@@ -48,6 +55,9 @@ class SecureChannel:
         self.host_mac_key = None
         self.mode = "es"
         self.is_open = False
+        # number of handshakes and secure messages, for diagnostics
+        self.handshakes = 0
+        self.messages = 0
 
     def get_card_pubkey(self):
         """Returns static public key of the card.
@@ -142,6 +152,7 @@ class SecureChannel:
         # reset iv
         self.iv = 0
         self.is_open = True
+        self.handshakes += 1
 
     def encrypt(self, data):
         """Encrypts the message for transmission"""
@@ -177,16 +188,29 @@ class SecureChannel:
             raise SecureChannelError("Wrong padding")
         return b"\x80".join(arr[:-1])
 
-    def request(self, data):
+    def request(self, data, resume=True):
         """Sends a secure request to the card
         and returns decrypted result.
         Raises a SecureError if errorcode returned from the card.
+        If the card rejects the message because it has no session
+        the channel is reopened and the request is sent once more.
+        With resume=False (PIN and secret commands) the request
+        goes over a fresh session instead and is never sent twice.
         """
         # if counter reached maximum - reestablish channel
-        if self.iv >= 2 ** 16 or not self.is_open:
+        if self.iv >= 2 ** 16 or not self.is_open or not resume:
             self.open()
         ct = self.encrypt(data)
-        res = self.applet.request(self.SECURE_MSG + encode(ct))
+        self.messages += 1
+        try:
+            res = self.applet.request(self.SECURE_MSG + encode(ct))
+        except ISOException as e:
+            if str(e) not in self.SESSION_LOST:
+                raise e
+            self.is_open = False
+            if not resume:
+                raise e
+            return self.request(data, resume=False)
         plaintext = self.decrypt(res)
         self.iv += 1
         if plaintext[:2] == self.SUCCESS:
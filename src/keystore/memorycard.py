@@ -204,6 +204,7 @@ In this mode device can only operate when the smartcard is inserted!"""
 
     def lock(self):
         """Locks the keystore, requires PIN to unlock"""
+        self.clear_derivation_cache()
         self.applet.lock()
         return self.is_locked
 
@@ -307,11 +308,14 @@ In this mode device can only operate when the smartcard is inserted!"""
             )  # no button
             asyncio.create_task(self.wait_for_card(scr))
             await self.show(scr)
-        try:
-            self.applet.ping()
-        except Exception as e:
-            print(e)
-            self.connected = False
+        # reuse the session if the card still responds,
+        # pin status is refreshed anyway so it replaces the ping
+        if self.connected:
+            try:
+                self.applet.get_pin_status()
+            except Exception as e:
+                print(e)
+                self.connected = False
         # only required if not connected yet
         if not self.connected:
             self.show_loader(title="Connecting to the card...")
@@ -326,7 +330,7 @@ In this mode device can only operate when the smartcard is inserted!"""
                 raise KeyStoreError("Failed to select the applet")
             self.applet.open_secure_channel()
             self.connected = True
-        self.applet.get_pin_status()
+            self.applet.get_pin_status()
         if check_pin and self.is_locked:
             pin = await self.get_pin()
             self._unlock(pin)
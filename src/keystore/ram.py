@@ -1,17 +1,56 @@
 from .core import KeyStore, KeyStoreError
 from platform import CriticalErrorWipeImmediately
 import platform
+import os
 from rng import get_random_bytes
 import hmac
 from embit import ec, bip39, bip32
 from embit.liquid import slip77
 from embit.transaction import SIGHASH
-from helpers import aead_encrypt, aead_decrypt, tagged_hash
+from helpers import AEADWriter, aead_encrypt_stream, aead_decrypt_stream, tagged_hash, LRUCache
 import secp256k1
+import gc
 from gui.screens import Alert, PinScreen, Prompt, Menu, QRAlert
 from gui.screens.mnemonic import ExportMnemonicScreen
 from binascii import hexlify
 
+class DerivationCache:
+    """
+    Derives child keys from the root reusing cached intermediate nodes,
+    so paths sharing the account-level prefix derive it only once.
+    Only parents are cached, leaf keys are derived on every call,
+    so signing many inputs doesn't push account nodes out of the cache.
+    """
+
+    def __init__(self, root, size=64):
+        self.root = root
+        # tuple(path) -> HDKey
+        self.nodes = LRUCache(size)
+
+    def derive(self, path):
+        if isinstance(path, str):
+            path = bip32.parse_path(path)
+        path = tuple(path)
+        # find the longest cached parent
+        node = self.root
+        start = 0
+        for l in range(len(path) - 1, 0, -1):
+            cached = self.nodes.get(path[:l])
+            if cached is not None:
+                node = cached
+                start = l
+                break
+        for l in range(start + 1, len(path)):
+            node = node.child(path[l - 1])
+            self.nodes.put(path[:l], node)
+        if path:
+            node = node.child(path[-1])
+        return node
+
+    def clear(self):
+        self.nodes.clear()
+
+
 class RAMKeyStore(KeyStore):
     """
     KeyStore that doesn't store your keys.
@@ -21,6 +60,8 @@ class RAMKeyStore(KeyStore):
     """
 
     storage_button = None
+    # number of derived nodes kept in memory while unlocked
+    DERIVATION_CACHE_SIZE = 16
 
     def __init__(self):
         # bip39 mnemonic
@@ -47,6 +88,8 @@ class RAMKeyStore(KeyStore):
         # but different for smartcards
         # to isolate card owners from each other
         self._userkey = None
+        # derived nodes, cleared on lock and wipe
+        self._derivation_cache = None
         self.initialized = False
         # show function for menus and stuff
         self.show = None
@@ -63,6 +106,8 @@ class RAMKeyStore(KeyStore):
             if not bip39.mnemonic_is_valid(self.mnemonic):
                 raise KeyStoreError("Invalid mnemonic")
         seed = bip39.mnemonic_to_seed(self.mnemonic, password)
+        # nodes of the previous root are not valid anymore
+        self.clear_derivation_cache()
         self.root = bip32.HDKey.from_seed(seed)
         self.fingerprint = self.root.child(0).fingerprint
         # slip 77 blinding key
@@ -71,60 +116,164 @@ class RAMKeyStore(KeyStore):
         # stored on untrusted external chip
         self.idkey = self.root.child(0x1D, hardened=True).key.serialize()
 
+    @property
+    def derivation_cache(self):
+        if self._derivation_cache is None:
+            if self.root is None:
+                raise KeyStoreError("Keystore is not ready")
+            self._derivation_cache = DerivationCache(self.root, self.DERIVATION_CACHE_SIZE)
+        return self._derivation_cache
+
+    def clear_derivation_cache(self):
+        """Drops all derived nodes so key material doesn't stay in memory"""
+        if self._derivation_cache is not None:
+            self._derivation_cache.clear()
+            self._derivation_cache.root = None
+            self._derivation_cache = None
+            gc.collect()
+
+    def derive(self, path):
+        """Derives a node from the root reusing cached prefixes"""
+        return self.derivation_cache.derive(path)
+
     def sign_psbt(self, psbt, sighash=SIGHASH.ALL):
         psbt.sign_with(self.root, sighash)
 
-    def sign_input(self, psbtv, i, sig_stream, sighash=SIGHASH.ALL, extra_scope_data=None):
+    def sign_input(self, psbtv, i, sig_stream, sighash=SIGHASH.ALL, extra_scope_data=None, ctx=None):
+        """
+        Signs input i with the root key.
+        ctx is an optional SighashContext shared by all signers of the transaction.
+        """
+        if extra_scope_data is None and ctx is not None:
+            extra_scope_data = ctx.input(i)
         return psbtv.sign_input(i, self.root, sig_stream, sighash=sighash, extra_scope_data=extra_scope_data)
 
-    def sign_hash(self, derivation, msghash: bytes):
-        return self.root.derive(derivation).key.sign(msghash)
-
-    def sign_recoverable(self, derivation, msghash: bytes):
+    def input_derivations(self, inp):
+        """Returns unique derivation paths of our keys in the input scope"""
+        ders = list(inp.bip32_derivations.values())
+        ders += [der for _, der in inp.taproot_bip32_derivations.values()]
+        res = []
+        for der in ders:
+            if der.fingerprint != self.fingerprint:
+                continue
+            path = tuple(der.derivation)
+            if path not in res:
+                res.append(path)
+        return res
+
+    def sign_inputs(self, psbtv, requests, sig_stream, ctx=None, separator=b"\x00"):
+        """
+        Signs a batch of inputs in one run.
+        requests is an iterable of (input index, derivations, sighash, is taproot)
+        in order of inputs, derivations are lists of indexes
+        from input_derivations(). If is taproot is None the input is parsed
+        to find out, otherwise the view reads the input itself when signing.
+        Common derivation prefixes are taken from the keystore derivation cache.
+        Signatures of every input are followed by the separator.
+        Returns number of signatures.
+        """
+        cache = self.derivation_cache
+        count = 0
+        for i, derivations, sighash, taproot in requests:
+            if derivations:
+                inp = None
+                if taproot is None:
+                    inp = ctx.input(i) if ctx else psbtv.input(i)
+                    taproot = bool(inp.taproot_bip32_derivations)
+                if taproot:
+                    # taproot key tweaking is done by the view when signing with the root
+                    count += psbtv.sign_input(i, self.root, sig_stream, sighash=sighash, extra_scope_data=inp)
+                    derivations = []
+                for der in derivations:
+                    prv = cache.derive(der).key
+                    count += psbtv.sign_input(i, prv, sig_stream, sighash=sighash, extra_scope_data=inp)
+            if separator:
+                sig_stream.write(separator)
+        return count
+
+    def sign_hash(self, derivation, msghash: bytes, cache=None):
+        """cache is an optional DerivationCache, keystore cache by default"""
+        node = (cache or self.derivation_cache).derive(derivation)
+        return node.key.sign(msghash)
+
+    def sign_recoverable(self, derivation, msghash: bytes, cache=None):
         """Returns a signature and a recovery flag"""
-        prv = self.root.derive(derivation).key
+        node = (cache or self.derivation_cache).derive(derivation)
+        prv = node.key
         sig = secp256k1.ecdsa_sign_recoverable(msghash, prv._secret)
         flag = sig[64]
         return ec.Signature(sig[:64]), flag
 
-    def save_aead(self, path, adata=b"", plaintext=b"", key=None):
-        """Encrypts and saves plaintext and associated data to file"""
+    def save_aead(self, path, adata=b"", plaintext=b"", key=None, sync=True):
+        """
+        Encrypts and saves plaintext and associated data to file.
+        plaintext can be bytes or a readable stream,
+        data is encrypted to the file chunk by chunk.
+        Data goes to a temp file first, so the old file stays intact
+        if encryption fails, and a reset while the old file is replaced
+        is recovered by load_aead() and platform.recover_file().
+        Pass sync=False to batch several writes and call platform.sync() once,
+        the temp file is always synced before it replaces an existing file.
+        """
         if key is None:
             key = self.idkey
         if key is None:
             raise KeyStoreError("Pass the key please")
-        d = aead_encrypt(key, adata, plaintext)
-        with open(path, "wb") as f:
-            f.write(d)
-        platform.sync()
-
-    def load_aead(self, path, key=None):
+        tmp = path + ".tmp"
+        try:
+            with open(tmp, "wb") as f:
+                if isinstance(plaintext, (bytes, bytearray, str)):
+                    with AEADWriter(key, f, adata) as w:
+                        w.write(plaintext)
+                else:
+                    aead_encrypt_stream(key, f, adata, plaintext)
+        except:
+            try:
+                os.remove(tmp)
+            except:
+                pass
+            raise
+        # FAT can't rename over an existing file
+        if platform.file_exists(path):
+            # temp file must be on flash before the old one is gone
+            platform.sync()
+            os.remove(path)
+        os.rename(tmp, path)
+        if sync:
+            platform.sync()
+
+    def load_aead(self, path, key=None, fout=None):
         """
         Loads data saved with save_aead,
-        returns a tuple (associated data, plaintext)
+        returns a tuple (associated data, plaintext).
+        If fout is passed plaintext is decrypted to it chunk by chunk
+        and its length is returned instead.
+        Without fout plaintext is kept in memory, it's meant for small files
+        (PIN state, secrets, settings) that callers need as a whole anyway.
         """
         if key is None:
             key = self.idkey
         if key is None:
             raise KeyStoreError("Pass the key please")
+        platform.recover_file(path)
         with open(path, "rb") as f:
-            data = f.read()
-        return aead_decrypt(data, key)
+            return aead_decrypt_stream(f, key, fout)
 
     def get_xpub(self, path):
         if self.is_locked or self.root is None:
             raise KeyStoreError("Keystore is not ready")
-        return self.root.derive(path).to_public()
+        return self.derive(path).to_public()
 
     def owns(self, key):
         if key.fingerprint is not None and key.fingerprint != self.fingerprint:
             return False
         if key.derivation is None:
             return key.key == self.root.to_public()
-        return key.key == self.root.derive(key.derivation).to_public()
+        return key.key == self.derive(key.derivation).to_public()
 
     def wipe(self, path):
         """Delete everything in path"""
+        self.clear_derivation_cache()
         platform.delete_recursively(path)
 
     def load_secret(self, path):
@@ -231,7 +380,7 @@ class RAMKeyStore(KeyStore):
 
     def lock(self):
         """Locks the keystore"""
-        pass
+        self.clear_derivation_cache()
 
     def _unlock(self, pin):
         """
@@ -119,7 +119,7 @@ class SDKeyStore(FlashKeyStore):
         if file.startswith(self.sdpath) and platform.sdcard.is_present:
             platform.sdcard.mount()
 
-        if not platform.file_exists(file):
+        if not platform.recover_file(file):
             raise KeyStoreError("Key is not saved")
         _, data = self.load_aead(file, self.enc_secret)
 
@@ -1,4 +1,5 @@
 import os
+import profiler
 from specter import Specter
 from gui.specter import SpecterGUI
 
@@ -8,6 +9,7 @@ from keystore.memorycard import MemoryCard
 
 from hosts import SDHost, QRHost, USBHost, Host
 import platform
+import ramstore
 from helpers import load_apps
 from app import BaseApp
 import display
@@ -20,9 +22,13 @@ def main(apps=None, network="main", keystore_cls=None):
     """
     # Init display first as it also inits the SDRAM
     display.init(False)
+    profiler.mark("display")
     # create virtual file system /sdram
     # for temp untrusted data storage
     rampath = platform.mount_sdram()
+    # transient host data and temp files are kept in RAM chunks
+    ramstore.init(rampath)
+    profiler.mark("sdram")
 
     # set working path to empty folder in sdram
     if not platform.simulator:
@@ -61,9 +67,9 @@ def main(apps=None, network="main", keystore_cls=None):
             SDKeyStore,
         ]
 
-    # loading apps
+    # apps are imported after unlock, see Specter.apps
     if apps is None:
-        apps = load_apps()
+        apps = load_apps
 
     # make Specter instance
     settings_path = platform.fpath("/flash")
@@ -75,6 +81,7 @@ def main(apps=None, network="main", keystore_cls=None):
         settings_path=settings_path,
         network=network,
     )
+    profiler.mark("init")
     specter.start()
 
 
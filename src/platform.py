@@ -79,6 +79,10 @@ class SDCard:
     def file_exists(self, filename) -> bool:
         return file_exists(fpath("/sd/" + filename.lstrip("/")))
 
+    @property
+    def is_mounted(self):
+        return self._mounted
+
     def unmount(self):
         """Unmounts SD card"""
         # sync file system before unmounting
@@ -153,6 +157,38 @@ def get_preallocated_ram():
     else:
         return sdram.preallocated_ptr(), sdram.preallocated_size()
 
+def get_preallocated_buffer():
+    """Returns preallocated memory as a writable memoryview"""
+    import uctypes
+    ptr, size = get_preallocated_ram()
+    return memoryview(uctypes.bytearray_at(ptr, size))
+
+# current user of the preallocated memory
+_preallocated_owner = None
+
+def acquire_preallocated_ram(owner):
+    """
+    Takes preallocated memory for exclusive use by the owner.
+    Returns pointer and size, or None if someone else is using it.
+    Free it with release_preallocated_ram(owner).
+    """
+    global _preallocated_owner
+    if _preallocated_owner is not None and _preallocated_owner is not owner:
+        return None
+    _preallocated_owner = owner
+    return get_preallocated_ram()
+
+def acquire_preallocated_buffer(owner):
+    """Same as acquire_preallocated_ram, but returns a writable memoryview or None"""
+    if acquire_preallocated_ram(owner) is None:
+        return None
+    return get_preallocated_buffer()
+
+def release_preallocated_ram(owner):
+    global _preallocated_owner
+    if _preallocated_owner is owner:
+        _preallocated_owner = None
+
 def sync():
     try:
         os.sync()
@@ -169,6 +205,23 @@ def file_exists(fname: str) -> bool:
         return False
 
 
+def recover_file(fname: str) -> bool:
+    """
+    Finishes replacement of fname with fname.tmp interrupted by reset.
+    The old file is removed only when the temp file is complete,
+    so the temp file is used if the old file is gone and dropped otherwise.
+    Returns True if fname exists.
+    """
+    tmp = fname + ".tmp"
+    if not file_exists(tmp):
+        return file_exists(fname)
+    if file_exists(fname):
+        os.remove(tmp)
+    else:
+        os.rename(tmp, fname)
+    return True
+
+
 def delete_recursively(path, include_self=False):
     # remove trailing slash
     if path is None:
@@ -0,0 +1,125 @@
+"""
+Lightweight profiler for the hot paths.
+Spans record time in us and free heap before and after,
+host counters track bytes read and written by every host.
+Records are kept in a ring buffer and can be dumped
+with "profile" USB command.
+When disabled span() returns a shared no-op object
+and counters return immediately.
+
+Boot timeline is recorded with mark() as time since the profiler import.
+
+Usage:
+    with profiler.span("psbt.parse"):
+        ...
+"""
+import time
+import gc
+import platform
+
+ENABLED = getattr(platform.config, "PROFILER", False)
+# number of spans kept in memory
+RING_SIZE = 64
+
+_ring = [None] * RING_SIZE
+_pos = 0
+_count = 0
+# host name -> [bytes read, bytes written]
+_io = {}
+# profiler is imported by main.py first, so it's close to boot time
+_t0 = time.ticks_us()
+
+
+class _NoSpan:
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        pass
+
+
+_NOSPAN = _NoSpan()
+
+
+class Span:
+    def __init__(self, name):
+        self.name = name
+
+    def __enter__(self):
+        self.mem = gc.mem_free()
+        self.t0 = time.ticks_us()
+        return self
+
+    def __exit__(self, *args):
+        dt = time.ticks_diff(time.ticks_us(), self.t0)
+        record(self.name, dt, self.mem, gc.mem_free())
+
+
+def enable(enabled=True):
+    global ENABLED
+    ENABLED = enabled
+
+
+def span(name):
+    """Returns a context manager measuring the block"""
+    if not ENABLED:
+        return _NOSPAN
+    return Span(name)
+
+
+def record(name, dt_us, mem_before=0, mem_after=0):
+    """Adds a record to the ring buffer, oldest records are overwritten"""
+    global _pos, _count
+    if not ENABLED:
+        return
+    _ring[_pos] = (name, dt_us, mem_before, mem_after)
+    _pos = (_pos + 1) % RING_SIZE
+    _count = min(_count + 1, RING_SIZE)
+
+
+def mark(name):
+    """Records a point of the boot timeline: time since boot and free heap"""
+    if not ENABLED:
+        return
+    mem = gc.mem_free()
+    record("boot." + name, time.ticks_diff(time.ticks_us(), _t0), mem, mem)
+
+
+def count_io(host, read=0, written=0):
+    """Adds bytes read from and written to the host"""
+    if not ENABLED:
+        return
+    c = _io.get(host)
+    if c is None:
+        c = [0, 0]
+        _io[host] = c
+    c[0] += read
+    c[1] += written
+
+
+def records():
+    """Returns records from the oldest to the newest"""
+    start = (_pos - _count) % RING_SIZE
+    return [_ring[(start + i) % RING_SIZE] for i in range(_count)]
+
+
+def clear():
+    global _pos, _count
+    for i in range(RING_SIZE):
+        _ring[i] = None
+    _pos = 0
+    _count = 0
+    _io.clear()
+
+
+def dump(stream):
+    """
+    Writes all records as text lines:
+    span <name> <us> <free heap before> <free heap after>
+    io <host> <bytes read> <bytes written>
+    """
+    for name, dt, m0, m1 in records():
+        stream.write(("span %s %d %d %d\n" % (name, dt, m0, m1)).encode())
+    for host in _io:
+        stream.write(("io %s %d %d\n" % (host, _io[host][0], _io[host][1])).encode())
+
@@ -3,22 +3,35 @@ from microur.util.bytewords import stream_pos
 from microur.encoder import UREncoder
 from bcur import bcur_encode_stream
 from helpers import b2a_base64_stream, read_write
+import ramstore
 
 class QREncoder:
-    """A simple encoder that just splits the data into chunks"""
+    """
+    A simple encoder that just splits the data into chunks.
+    Encoded data is kept in the tempfile in the RAM store,
+    so parts are read from RAM chunks and only data that doesn't fit
+    in the store goes to the ramdisk.
+    The tempfile is removed on exit from the context.
+    """
     is_infinite = False
     MAX_PREFIX_LEN = 0
+    # format name to store density settings
+    FORMAT = "raw"
+    # parts are strings
+    TEXT_MODE = True
 
     def __init__(self, stream, part_len=300, tempfile=None):
         if tempfile is None:
             raise ValueError("Temp file is required for this encoder")
-        with open(tempfile, "wb") as fout:
-            self._start, self._len = self.convert(stream, fout)
         self.tempfile = tempfile
+        with ramstore.open(tempfile, "wb") as fout:
+            self._start, self._len = self.convert(stream, fout)
         self.f = None
         self._start = 0
         self._num = 0
         self.part_len = part_len
+        # QR density (index in QR_SIZES) selected by the user, None for auto
+        self.qr_version = None
 
     def convert(self, fin, fout):
         # dummy convertion, just copy to the tempfile
@@ -34,11 +47,17 @@ class QREncoder:
             part_len -= self.MAX_PREFIX_LEN
         self._part_len = math.ceil(self._len / math.ceil(self._len / part_len))
 
+    def num_parts(self, part_len):
+        """Number of parts for part_len, doesn't change the encoder"""
+        if part_len > 2 * self.MAX_PREFIX_LEN:
+            part_len -= self.MAX_PREFIX_LEN
+        return math.ceil(self._len / part_len)
+
     def get_full(self, maxlen=None):
         if maxlen is not None and maxlen < self._len:
             return ""
         self.f.seek(0, 0)
-        return self.f.read()
+        return self._read()
 
     def __len__(self):
         return math.ceil(self._len / self.part_len)
@@ -46,7 +65,7 @@ class QREncoder:
     def __getitem__(self, idx):
         idx = idx % len(self)
         self.f.seek(self._start + idx*self.part_len, 0)
-        return self.f.read(self.part_len)
+        return self._read(self.part_len)
 
     def __iter__(self):
         self._num = 0
@@ -58,20 +77,31 @@ class QREncoder:
         self._num += 1
         return self.__getitem__(self._num-1)
 
+    def _read(self, n=-1):
+        """Reads encoded data from the current position"""
+        data = self.f.read(n)
+        return data.decode() if self.TEXT_MODE else data
+
     def __enter__(self):
         if self.f is None:
-            self.f = open(self.tempfile, "r")
+            self.f = ramstore.open(self.tempfile, "rb")
         return self
 
     def __exit__(self, exc_type, exc_value, exc_tb):
         if self.f is not None:
             self.f.close()
+            self.f = None
+        try:
+            ramstore.remove(self.tempfile)
+        except OSError:
+            pass
 
     def __str__(self):
         return self.get_full()
 
 class Base64QREncoder(QREncoder):
     MAX_PREFIX_LEN = 8
+    FORMAT = "text"
 
     def convert(self, fin ,fout):
         return 0, b2a_base64_stream(fin, fout)
@@ -79,10 +109,11 @@ class Base64QREncoder(QREncoder):
     def __getitem__(self, idx):
         idx = idx % len(self)
         self.f.seek(self._start + idx*self.part_len, 0)
-        return "p%dof%d %s" % (idx+1, len(self), self.f.read(self.part_len))
+        return "p%dof%d %s" % (idx+1, len(self), self._read(self.part_len))
 
 class LegacyBCUREncoder(QREncoder):
     MAX_PREFIX_LEN = 73 # uh... large one, and pretty useless
+    FORMAT = "bcur"
 
     def convert(self, fin ,fout):
         cur, sz = stream_pos(fin)
@@ -94,18 +125,21 @@ class LegacyBCUREncoder(QREncoder):
         if maxlen is not None and maxlen < self._len+9:
             return ""
         self.f.seek(0, 0)
-        return "UR:BYTES/" + self.f.read()
+        return "UR:BYTES/" + self._read()
 
     def __getitem__(self, idx):
         if len(self) == 1:
-            return "UR:BYTES/" + self.f.read()
+            return "UR:BYTES/" + self._read()
         idx = idx % len(self)
         self.f.seek(self._start + idx*self.part_len, 0)
-        return "UR:BYTES/%dOF%d/%s/%s" % (idx+1, len(self), self.enc_hash, self.f.read(self.part_len))
+        return "UR:BYTES/%dOF%d/%s/%s" % (idx+1, len(self), self.enc_hash, self._read(self.part_len))
 
 class CryptoPSBTEncoder(QREncoder):
     is_infinite = True
     MAX_PREFIX_LEN = 22
+    FORMAT = "crypto-psbt"
+    # raw psbt is stored, encoder needs bytes
+    TEXT_MODE = False
 
     def __init__(self, *args, **kwargs):
         self.encoder = None
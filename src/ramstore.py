@@ -0,0 +1,307 @@
+"""
+In-RAM store for transient files (host data, temp PSBTs, signatures).
+Files are lists of fixed-size chunks taken from one arena
+with a bump pointer, removed chunks go to a free list.
+The arena is allocated on the heap with the first chunk
+and freed when the last file is removed, so it doesn't hold
+the memory while no transient files exist.
+Handles of removed files are invalidated and raise OSError,
+so they never see chunks reused by other files.
+Only paths under the store root are kept in RAM, everything else
+goes to the regular filesystem, so open() here is a drop-in replacement
+for the builtin one. If the arena is full the file is moved
+to the filesystem under the same path and writing continues there.
+"""
+import os
+import gc
+import builtins
+import platform
+
+CHUNK_SIZE = 1024
+# arena size, bigger files are moved to the filesystem
+SIZE = getattr(platform.config, "RAMSTORE_SIZE", 128 * 1024)
+MIN_CHUNKS = 64
+
+_store = None
+
+
+class RAMStore:
+    def __init__(self, root, size):
+        self.root = root.rstrip("/") + "/"
+        self.num_chunks = size // CHUNK_SIZE
+        # arena is allocated with the first chunk
+        self.buf = None
+        self.mv = None
+        # path -> [list of chunks, size]
+        self.files = {}
+        self.reset()
+
+    def reset(self):
+        """Drops all files and frees the arena"""
+        for entry in self.files.values():
+            entry[0] = None
+        self.files = {}
+        self.top = 0
+        self.free = []
+        if self.buf is not None:
+            self.mv = None
+            self.buf = None
+            gc.collect()
+
+    def owns(self, path):
+        return path.startswith(self.root)
+
+    def alloc(self):
+        if self.free:
+            return self.free.pop()
+        if self.top >= self.num_chunks:
+            raise MemoryError("RAM store is full")
+        if self.buf is None:
+            # MemoryError here moves the file to the filesystem
+            self.buf = bytearray(self.num_chunks * CHUNK_SIZE)
+            self.mv = memoryview(self.buf)
+        self.top += 1
+        return self.top - 1
+
+    def chunk(self, i):
+        return self.mv[i * CHUNK_SIZE:(i + 1) * CHUNK_SIZE]
+
+    def remove(self, path):
+        entry = self.files.pop(path, None)
+        if entry is None:
+            return False
+        chunks = entry[0]
+        # open handles of this file fail from now on
+        entry[0] = None
+        if self.files:
+            self.free.extend(chunks)
+        else:
+            self.reset()
+        return True
+
+    def create(self, path):
+        """
+        Returns a new empty entry for path, chunks of the old file are freed.
+        The arena is kept even if it was the only file.
+        """
+        entry = [[], 0]
+        old = self.files.get(path)
+        self.files[path] = entry
+        if old is not None:
+            self.free.extend(old[0])
+            old[0] = None
+        return entry
+
+    def remove_recursively(self, path):
+        prefix = path.rstrip("/") + "/"
+        for p in [p for p in self.files if p.startswith(prefix)]:
+            self.remove(p)
+
+    @property
+    def used(self):
+        return (self.top - len(self.free)) * CHUNK_SIZE
+
+
+class RAMFile:
+    """File-like object over the chunks of the store entry"""
+
+    def __init__(self, store, path, entry, pos=0):
+        self.store = store
+        self.path = path
+        self.entry = entry
+        self.pos = pos
+        self._f = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def __iter__(self):
+        return self
+
+    def __next__(self):
+        line = self.readline()
+        if not line:
+            raise StopIteration
+        return line
+
+    def _chunks(self):
+        if self.entry is None or self.entry[0] is None:
+            raise OSError("File is closed or removed")
+        return self.entry[0]
+
+    def readinto(self, buf, n=None):
+        if self._f is not None:
+            return self._f.readinto(buf) if n is None else self._f.readinto(memoryview(buf)[:n])
+        chunks = self._chunks()
+        size = self.entry[1]
+        n = len(buf) if n is None else min(n, len(buf))
+        n = max(0, min(n, size - self.pos))
+        mv = memoryview(buf)
+        done = 0
+        while done < n:
+            ci, off = divmod(self.pos, CHUNK_SIZE)
+            l = min(n - done, CHUNK_SIZE - off)
+            mv[done:done + l] = self.store.chunk(chunks[ci])[off:off + l]
+            done += l
+            self.pos += l
+        return done
+
+    def read(self, n=-1):
+        if self._f is not None:
+            return self._f.read(n)
+        self._chunks()
+        left = self.entry[1] - self.pos
+        if n is None or n < 0 or n > left:
+            n = max(left, 0)
+        buf = bytearray(n)
+        self.readinto(buf)
+        return bytes(buf)
+
+    def readline(self, limit=-1):
+        if self._f is not None:
+            return self._f.readline() if limit < 0 else self._f.readline(limit)
+        chunks = self._chunks()
+        end = self.entry[1] if limit < 0 else min(self.entry[1], self.pos + limit)
+        res = b""
+        while self.pos < end:
+            ci, off = divmod(self.pos, CHUNK_SIZE)
+            part = bytes(self.store.chunk(chunks[ci])[off:off + min(end - self.pos, CHUNK_SIZE - off)])
+            i = part.find(b"\n")
+            if i >= 0:
+                part = part[:i + 1]
+            res += part
+            self.pos += len(part)
+            if i >= 0:
+                break
+        return res
+
+    def write(self, data):
+        if self._f is not None:
+            return self._f.write(data)
+        chunks = self._chunks()
+        mv = memoryview(data)
+        n = len(data)
+        done = 0
+        try:
+            while done < n:
+                ci, off = divmod(self.pos, CHUNK_SIZE)
+                while ci >= len(chunks):
+                    chunks.append(self.store.alloc())
+                l = min(n - done, CHUNK_SIZE - off)
+                self.store.chunk(chunks[ci])[off:off + l] = mv[done:done + l]
+                done += l
+                self.pos += l
+                self.entry[1] = max(self.entry[1], self.pos)
+        except MemoryError:
+            self._spill()
+            self._f.write(mv[done:])
+        return n
+
+    def _spill(self):
+        """Moves the file to the filesystem when the arena is full"""
+        pos = self.pos
+        f = builtins.open(self.path, "w+b")
+        self.pos = 0
+        buf = bytearray(CHUNK_SIZE)
+        while True:
+            n = self.readinto(buf)
+            if n == 0:
+                break
+            f.write(buf[:n] if n < CHUNK_SIZE else buf)
+        f.seek(pos)
+        self.store.remove(self.path)
+        self._f = f
+
+    def seek(self, offset, whence=0):
+        if self._f is not None:
+            return self._f.seek(offset, whence)
+        self._chunks()
+        if whence == 1:
+            offset += self.pos
+        elif whence == 2:
+            offset += self.entry[1]
+        self.pos = max(0, offset)
+        return self.pos
+
+    def tell(self):
+        if self._f is not None:
+            return self._f.tell()
+        return self.pos
+
+    def flush(self):
+        if self._f is not None:
+            self._f.flush()
+
+    def close(self):
+        if self._f is not None:
+            self._f.close()
+            self._f = None
+        self.entry = None
+
+
+def init(root, size=None):
+    """Creates the store for paths under root, SIZE bytes by default"""
+    global _store
+    _store = None
+    gc.collect()
+    if size is None:
+        size = SIZE
+    size = max(size, MIN_CHUNKS * CHUNK_SIZE)
+    _store = RAMStore(root, size)
+    return _store
+
+
+def get_store():
+    return _store
+
+
+def _owned(path):
+    return _store is not None and isinstance(path, str) and _store.owns(path)
+
+
+def open(path, mode="rb"):
+    if not _owned(path) or "b" not in mode:
+        return builtins.open(path, mode)
+    entry = _store.files.get(path)
+    if "w" in mode:
+        return RAMFile(_store, path, _store.create(path))
+    if entry is None:
+        if "a" in mode and not exists(path):
+            entry = [[], 0]
+            _store.files[path] = entry
+        else:
+            # spilled to the filesystem or never stored
+            return builtins.open(path, mode)
+    return RAMFile(_store, path, entry, pos=entry[1] if "a" in mode else 0)
+
+
+def exists(path):
+    if _owned(path) and path in _store.files:
+        return True
+    try:
+        os.stat(path)
+        return True
+    except OSError:
+        return False
+
+
+def size(path):
+    if _owned(path) and path in _store.files:
+        return _store.files[path][1]
+    return os.stat(path)[6]
+
+
+def remove(path):
+    if _owned(path) and _store.remove(path):
+        return
+    os.remove(path)
+
+
+def delete_recursively(path, include_self=False):
+    """Removes stored files under path and the path on the filesystem"""
+    if _store is not None:
+        _store.remove_recursively(path)
+    platform.delete_recursively(path, include_self=include_self)
@@ -3,6 +3,8 @@ import gc
 import json
 from io import BytesIO
 import asyncio
+import platform
+import profiler
 
 from platform import (
     CriticalErrorWipeImmediately,
@@ -51,7 +53,10 @@ class Specter:
         self.path = settings_path
         self.current_menu = self.initmenu
         self.dev = False
-        self.apps = apps
+        # list of apps or a function loading them
+        self._apps = apps
+        # apps initialized for current keystore and network
+        self._active_apps = []
 
     def start(self):
         # register battery monitor (runs every 3 seconds)
@@ -123,8 +128,10 @@ class Specter:
 
             # load secrets
             await self.keystore.init(self.gui.show_screen(), self.gui.show_loader)
+            profiler.mark("keystore")
             # unlock with PIN or set up the PIN code
             await self.unlock()
+            profiler.mark("unlock")
         except Exception as e:
             next_fn = await self.handle_exception(e, self.setup)
             await next_fn()
@@ -158,9 +165,32 @@ class Specter:
                 next_fn = await self.handle_exception(e, self.setup)
                 await next_fn()
 
+    @property
+    def apps(self):
+        """Apps are imported on first access to keep boot fast"""
+        if callable(self._apps):
+            with profiler.span("boot.apps"):
+                self._apps = self._apps()
+        return self._apps
+
     def init_apps(self):
+        """
+        Binds apps to the current keystore and network.
+        Apps are initialized in activate_app() on first use.
+        """
+        self._active_apps = []
         for app in self.apps:
-            app.init(self.keystore, self.network, self.gui.show_loader, self.cross_app_communicate)
+            app.prepare(self.keystore, self.network, self.gui.show_loader, self.cross_app_communicate)
+        profiler.mark("apps")
+
+    def activate_app(self, app):
+        """Initializes the app if it was not used with current keystore and network"""
+        if app not in self._active_apps:
+            self.gui.show_loader(title="Loading application...")
+            with profiler.span("app.init.%s" % app.name):
+                app.init(self.keystore, self.network, self.gui.show_loader, self.cross_app_communicate)
+            self._active_apps.append(app)
+        return app
 
     async def cross_app_communicate(self, stream, app:str=None, show_fn=None):
         if app == "": # root
@@ -246,7 +276,10 @@ class Specter:
         stream = await host.get_data()
         if not stream:
             return
-        data = stream.read()
+        try:
+            data = stream.read()
+        finally:
+            host.release_data()
         # digital mnemonic
         if len(data) >= 4*12 and len(data) <= 4*24 and len(data) % 12 == 0 and (b" " not in data):
             mnemonic = " ".join([bip39.WORDLIST[int(data[4*i:4*i+4])] for i in range(len(data)//4)])
@@ -312,7 +345,7 @@ class Specter:
         elif menuitem == 3:
             return await self.settingsmenu()
         elif isinstance(menuitem, BaseApp) and hasattr(menuitem, "menu"):
-            app = menuitem
+            app = self.activate_app(menuitem)
             # stay in this menu while something is returned
             while await app.menu(self.gui.show_screen()):
                 pass
@@ -323,7 +356,10 @@ class Specter:
             # probably user cancelled
             if stream is not None:
                 # check against all apps
-                res = await self.process_host_request(stream, popup=False)
+                try:
+                    res = await self.process_host_request(stream, popup=False)
+                finally:
+                    host.release_data()
                 if res not in [True, False, None]:
                     await host.send_data(*res)
         else:
@@ -504,6 +540,8 @@ class Specter:
         ]
         if hasattr(self.keystore, "lock"):
             buttons.extend([(777, "Change PIN code")])
+        if profiler.ENABLED:
+            buttons.extend([(888, "Save profiler data to SD card")])
         buttons += [
             (456, "Reboot"),
             (123, "Wipe the device", True, 0x951E2D),
@@ -538,12 +576,23 @@ class Specter:
             elif menuitem == 777:
                 await self.keystore.change_pin()
                 return
+            elif menuitem == 888:
+                await self.save_profile()
             elif menuitem == 1:
                 await self.communication_settings()
             else:
                 print(menuitem)
                 raise SpecterError("Not implemented")
 
+    async def save_profile(self):
+        if not platform.sdcard.is_present:
+            raise SpecterError("SD card is not present")
+        fname = "profile.txt"
+        with platform.sdcard as sd:
+            with sd.open(fname, "wb") as f:
+                profiler.dump(f)
+        await self.gui.alert("Success!", "Profiler data is saved to\n\n%s" % fname)
+
     @property
     def fingerprint(self):
         return self.keystore.fingerprint
@@ -637,8 +686,8 @@ class Specter:
                 raise HostError(
                     "Not sure what app to use...\n\nThere are %d" % len(matching_apps)
                 )
+            app = self.activate_app(matching_apps[0])
             stream.seek(0)
-            app = matching_apps[0]
             res = await app.process_host_command(stream, show_fn)
         except Exception as e:
             if isinstance(e, BaseError):
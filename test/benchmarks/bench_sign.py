@@ -0,0 +1,209 @@
+"""
+PSBT / PSET signing benchmarks.
+Every case generates a synthetic transaction spending inputs of a single wallet
+while other stored wallets of the same type act as decoys,
+then measures preprocess_psbt and sign_psbtview.
+Time and heap are taken from profiler spans around the calls,
+ramdisk I/O is bytes read from the input and written to the output.
+"""
+import gc
+import profiler
+from binascii import hexlify
+from embit import ec, hashes, script
+from embit.psbt import PSBT, DerivationPath
+from embit.psbtview import PSBTView
+from embit.transaction import Transaction, TransactionInput, TransactionOutput
+from embit.liquid.networks import NETWORKS
+from embit.liquid.pset import PSET
+from embit.liquid.psetview import PSETView
+from embit.liquid.transaction import LTransaction, LTransactionInput, LTransactionOutput
+from helpers import ReadCounter
+from tests.util import get_keystore, get_wallets_app, clear_testdir, TEST_DIR
+
+MNEMONIC = "ability "*11+"acid"
+# foreign cosigner for multisig and miniscript wallets
+FOREIGN = "[8cce63f8/48h/1h/%dh/2h]tpubDCZWxJ6kKqRHep5a2XycxrXRaTES1vs3ysfV7sdv5uhkaEgxBEdVbyQT46m3NcaLJqVNd41TYqDyQfvweLLXGmkxdHRnhxuJPf7BAWMXni2/{0,1}/*"
+
+# type: (network, derivation of our key, descriptor template)
+TYPES = {
+    "wpkh": ("regtest", "m/84h/1h/%dh", "wpkh(%s)"),
+    "wsh": ("regtest", "m/48h/1h/%dh/2h", "wsh(sortedmulti(2,%s,%s))"),
+    "tr": ("regtest", "m/86h/1h/%dh", "tr(%s)"),
+    "miniscript": ("regtest", "m/48h/1h/%dh/2h", "wsh(or_d(pk(%s),and_v(v:pkh(%s),older(1000))))"),
+    "confidential": ("elementsregtest", "m/84h/1h/%dh", "blinded(slip77(%s),wpkh(%s))"),
+}
+# (inputs, outputs)
+SIZES = [(1, 1), (10, 2), (50, 50), (100, 2), (500, 2), (2, 500)]
+WALLETS = [1, 10, 50]
+QUICK_SIZES = [(1, 1), (10, 2)]
+QUICK_WALLETS = [1, 10]
+
+INPUT_VALUE = 100000
+FEE = 1000
+
+
+def key_expr(keystore, network, der):
+    xpub = keystore.get_xpub(der).to_base58(NETWORKS[network]["xpub"])
+    return "[%s%s]%s/{0,1}/*" % (hexlify(keystore.fingerprint).decode(), der[1:], xpub)
+
+
+def descriptor(keystore, kind, account):
+    network, der, template = TYPES[kind]
+    ours = key_expr(keystore, network, der % account)
+    if kind in ["wsh", "miniscript"]:
+        return template % (ours, FOREIGN % account)
+    if kind == "confidential":
+        return template % (keystore.slip77_key, ours)
+    return template % ours
+
+
+def setup(kind, num_wallets, pipelined=False):
+    """Returns wallets app with num_wallets wallets and the target wallet"""
+    clear_testdir()
+    ks = get_keystore(mnemonic=MNEMONIC, password="")
+    wapp = get_wallets_app(ks, TYPES[kind][0])
+    manager = wapp.manager
+    manager.pipelined_signing = pipelined
+    # default wallet is wpkh on account 0
+    start = 1 if kind in ["wpkh", "confidential"] else 0
+    for account in range(start, num_wallets):
+        w = manager.parse_wallet("Bench %d&%s" % (account, descriptor(ks, kind, account)))
+        manager.add_wallet(w)
+    return wapp, manager.wallets[-num_wallets]
+
+
+def _txid(i):
+    return hashes.sha256(b"bench input" + i.to_bytes(4, "little"))
+
+
+def _external(i):
+    return ec.PrivateKey(hashes.sha256(b"bench output" + i.to_bytes(4, "little"))).get_public_key()
+
+
+def _out_values(num_inputs, num_outputs):
+    total = num_inputs * INPUT_VALUE - FEE
+    values = [total // num_outputs] * num_outputs
+    values[-1] += total - sum(values)
+    return values
+
+
+def _fill_input(inp, w, i, taproot):
+    desc = w.derive(i, 0)
+    for key in desc.keys:
+        pub = key.get_public_key()
+        der = DerivationPath(key.fingerprint, key.derivation)
+        if taproot:
+            inp.taproot_bip32_derivations[pub] = ([], der)
+        else:
+            inp.bip32_derivations[pub] = der
+    inp.witness_script = desc.witness_script()
+    return desc.script_pubkey()
+
+
+def make_psbt(w, num_inputs, num_outputs, taproot=False):
+    values = _out_values(num_inputs, num_outputs)
+    tx = Transaction(
+        vin=[TransactionInput(_txid(i), 0) for i in range(num_inputs)],
+        vout=[TransactionOutput(values[i], script.p2wpkh(_external(i))) for i in range(num_outputs)],
+    )
+    psbt = PSBT(tx)
+    for i, inp in enumerate(psbt.inputs):
+        sc = _fill_input(inp, w, i, taproot)
+        inp.witness_utxo = TransactionOutput(INPUT_VALUE, sc)
+    return psbt
+
+
+def make_pset(w, num_inputs, num_outputs):
+    asset = hashes.sha256(b"bench asset")
+    values = _out_values(num_inputs, num_outputs)
+    vout = [LTransactionOutput(asset, values[i], script.p2wpkh(_external(i))) for i in range(num_outputs)]
+    vout.append(LTransactionOutput(asset, FEE, script.Script(b"")))
+    tx = LTransaction(
+        vin=[LTransactionInput(_txid(i), 0) for i in range(num_inputs)],
+        vout=vout,
+    )
+    pset = PSET(tx, version=2)
+    for i, inp in enumerate(pset.inputs):
+        sc = _fill_input(inp, w, i, False)
+        inp.witness_utxo = LTransactionOutput(asset, INPUT_VALUE, sc)
+    for i in range(num_outputs):
+        pset.outputs[i].blinding_pubkey = _external(num_outputs + i).sec()
+    # deterministic blinding
+    pset.unknown[b"\xfc\x07specter\x00"] = hashes.sha256(b"bench seed")
+    return pset
+
+
+def measure(name, fn, *args):
+    """
+    Returns result of the call and its wall time (ms)
+    and heap used by the call (bytes) from the profiler span
+    """
+    enabled = profiler.ENABLED
+    profiler.enable()
+    profiler.clear()
+    gc.collect()
+    try:
+        with profiler.span(name):
+            res = fn(*args)
+        # outer span is closed last
+        _, dt, mem_before, mem_after = profiler.records()[-1]
+    finally:
+        profiler.enable(enabled)
+    return res, {"ms": dt // 1000, "heap": mem_before - mem_after}
+
+
+def run_case(wapp, w, kind, num_inputs, num_outputs):
+    manager = wapp.manager
+    if kind == "confidential":
+        tx = make_pset(w, num_inputs, num_outputs)
+        view_cls = PSETView
+    else:
+        tx = make_psbt(w, num_inputs, num_outputs, taproot=(kind == "tr"))
+        view_cls = PSBTView
+    tmp = TEST_DIR + "/tmp"
+    with open(tmp + "/bench_unsigned", "wb") as f:
+        tx.write_to(f)
+    del tx
+    gc.collect()
+
+    with open(tmp + "/bench_unsigned", "rb") as fin, open(tmp + "/bench_raw", "wb") as fout:
+        fin = ReadCounter(fin)
+        (wallets, meta), pre = measure("bench.preprocess", manager.preprocess_psbt, fin, fout)
+        # output is written sequentially
+        pre["ramdisk"] = fin.count + fout.tell()
+    del meta
+    gc.collect()
+
+    with open(tmp + "/bench_raw", "rb") as fin, open(tmp + "/bench_signed", "wb") as fout:
+        fin = ReadCounter(fin)
+        psbtv = view_cls.view(fin, compress=True)
+        sigs, sign = measure("bench.sign", manager.sign_psbtview, psbtv, fout, wallets, None)
+        sign["ramdisk"] = fin.count + fout.tell()
+    if not sigs:
+        raise RuntimeError("%s: nothing signed" % kind)
+    return {
+        "type": kind,
+        "inputs": num_inputs,
+        "outputs": num_outputs,
+        "wallets": len(manager.wallets),
+        "signatures": sigs,
+        "preprocess_psbt": pre,
+        "sign_psbtview": sign,
+    }
+
+
+def run(kinds=None, quick=False, log=None, pipelined=False):
+    """Runs all benchmark cases and returns list of results"""
+    results = []
+    for kind in (kinds or sorted(TYPES)):
+        for num_wallets in (QUICK_WALLETS if quick else WALLETS):
+            wapp, w = setup(kind, num_wallets, pipelined)
+            for num_inputs, num_outputs in (QUICK_SIZES if quick else SIZES):
+                res = run_case(wapp, w, kind, num_inputs, num_outputs)
+                if log:
+                    log(res)
+                results.append(res)
+            del wapp, w
+            gc.collect()
+    clear_testdir()
+    return results
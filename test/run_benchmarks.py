@@ -0,0 +1,61 @@
+"""
+Runs signing benchmarks in the unix simulator build and prints JSON results.
+
+Usage: micropython_unix run_benchmarks.py [quick] [pipelined] [out=<file.json>] [types...]
+pipelined enables PIPELINED_SIGNING, compare with a normal run to see
+the difference in ramdisk bytes read by sign_psbtview.
+Results are sorted by type, wallet count and size, keys of every object
+are sorted so outputs of two firmware versions can be diffed directly.
+"""
+import sys
+sys.path.append('../src')
+sys.path.append('../f469-disco/libs/common')
+sys.path.append('../f469-disco/libs/unix')
+sys.path.append('../f469-disco/usermods/udisplay_f469/display_unixport')
+sys.path.append('../f469-disco/tests')
+
+import json
+import platform
+from benchmarks import bench_sign
+
+
+def to_json(obj, indent=""):
+    """json.dumps with sorted keys, one result per line"""
+    if isinstance(obj, dict):
+        return "{" + ", ".join(["%s: %s" % (json.dumps(k), to_json(obj[k])) for k in sorted(obj)]) + "}"
+    if isinstance(obj, list):
+        return "[\n" + ",\n".join([indent + "  " + to_json(v) for v in obj]) + "\n" + indent + "]"
+    return json.dumps(obj)
+
+
+def log(res):
+    print("%(type)s: %(inputs)d in, %(outputs)d out, %(wallets)d wallets" % res, file=sys.stderr)
+
+
+def main():
+    args = sys.argv[1:]
+    quick = "quick" in args
+    pipelined = "pipelined" in args
+    out = None
+    kinds = []
+    for arg in args:
+        if arg.startswith("out="):
+            out = arg[4:]
+        elif arg not in ["quick", "pipelined"]:
+            if arg not in bench_sign.TYPES:
+                raise ValueError("Unknown type %s, use one of %s" % (arg, ", ".join(sorted(bench_sign.TYPES))))
+            kinds.append(arg)
+    results = bench_sign.run(kinds=kinds, quick=quick, log=log, pipelined=pipelined)
+    res = to_json({
+        "version": platform.get_version(),
+        "quick": quick,
+        "pipelined": pipelined,
+        "results": results,
+    }) + "\n"
+    if out:
+        with open(out, "w") as f:
+            f.write(res)
+    print(res)
+
+
+main()
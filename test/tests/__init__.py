@@ -2,4 +2,7 @@ from .test_keystore import *
 from .test_wallets import *
 from .test_sign import *
 from .test_revault import *
-from .test_compatibility import *
\ No newline at end of file
+from .test_compatibility import *
+from .test_ramstore import *
+from .test_hosts import *
+from .test_qrcode import *
@@ -0,0 +1,243 @@
+from unittest import TestCase
+import asyncio
+import time
+import platform
+import ramstore
+from hosts.qr import QRHost
+from hosts.usb import USBHost
+from hosts.core import Host, HostError
+from hosts.sd import PrefixedStream
+import profiler
+from io import BytesIO
+from .util import TEST_DIR, clear_testdir
+
+
+class PartsHost(QRHost):
+    """QRHost without scanner hardware, only part assembly"""
+
+    def __init__(self, path):
+        self.path = path
+
+    def _stop_scanner(self):
+        pass
+
+    def read_data(self):
+        with ramstore.open(self.datafile, "rb") as f:
+            return f.read()
+
+
+class FakeUSB:
+    """
+    USB VCP with scripted reads: read() returns the next packet,
+    readinto() takes raw bytes from the stream.
+    At most write_limit bytes are accepted per write, 0 - nothing.
+    """
+
+    def __init__(self, packets=(), stream=b"", write_limit=None):
+        self.packets = list(packets)
+        self.stream = stream
+        self.write_limit = write_limit
+        self.out = b""
+
+    def read(self, n=-1):
+        if not self.packets:
+            return None
+        return self.packets.pop(0)
+
+    def readinto(self, buf, n=None):
+        n = min(len(buf), len(self.stream)) if n is None else min(n, len(self.stream))
+        buf[:n] = self.stream[:n]
+        self.stream = self.stream[n:]
+        return n
+
+    def any(self):
+        return len(self.packets) + len(self.stream)
+
+    def write(self, data):
+        n = len(data) if self.write_limit is None else min(len(data), self.write_limit)
+        self.out += bytes(data[:n])
+        return n
+
+
+def get_usbhost(usb):
+    clear_testdir()
+    platform.maybe_mkdir(TEST_DIR)
+    host = USBHost(TEST_DIR + "/usb")
+    host.usb = usb
+    return host
+
+
+def read_file(fname):
+    with ramstore.open(fname, "rb") as f:
+        return f.read()
+
+
+def get_qrhost():
+    clear_testdir()
+    platform.maybe_mkdir(TEST_DIR)
+    path = TEST_DIR + "/qr"
+    platform.maybe_mkdir(path)
+    return PartsHost(path)
+
+
+class QRPartsTest(TestCase):
+
+    def assemble(self, host, parts, order, header=b""):
+        host.start_parts(len(parts), header)
+        for j, i in enumerate(order):
+            done = host.add_part(i + 1, parts[i])
+            self.assertEqual(done, j == len(order) - 1)
+        return host.read_data()
+
+    def test_out_of_order(self):
+        host = get_qrhost()
+        parts = [b"aaaa", b"bbbb", b"cccc", b"dd"]
+        # short last part arrives first, before part length is known
+        data = self.assemble(host, parts, [3, 1, 0, 2], b"hdr")
+        self.assertEqual(data, b"hdr" + b"".join(parts))
+        self.assertTrue(host.streaming)
+        # repeated parts are ignored
+        host.start_parts(len(parts))
+        self.assertFalse(host.add_part(2, parts[1]))
+        self.assertFalse(host.add_part(2, parts[1]))
+        self.assertEqual(host.received_count, 1)
+
+    def test_uneven_parts(self):
+        host = get_qrhost()
+        # parts of different lengths fall back to per-part files
+        parts = [b"aaaa", b"bbbbbb", b"dd", b"c"]
+        data = self.assemble(host, parts, [3, 0, 2, 1])
+        self.assertEqual(data, b"".join(parts))
+        self.assertFalse(host.streaming)
+
+
+class USBUploadTest(TestCase):
+
+    def upload(self, host):
+        """Reads upload line and its data like USBHost.update()"""
+        fname = host.read_to_file()
+        while fname is None:
+            fname = host.read_to_file()
+        size = host.get_upload_size(fname)
+        return read_file(asyncio.run(host.read_upload(size)))
+
+    def test_upload_with_tail(self):
+        # data arrives together with the upload line,
+        # bytes after the upload are not part of it
+        usb = FakeUSB([b"upload 5\r\nab", b"cdeXYZ"])
+        host = get_usbhost(usb)
+        fname = host.read_to_file()
+        self.assertEqual(host.get_upload_size(fname), 5)
+        self.assertEqual(host.tail, b"ab")
+        usb.stream = usb.packets.pop(0)
+        res = asyncio.run(host.read_upload(5))
+        self.assertEqual(read_file(res), b"abcde")
+        self.assertEqual(host.tail, b"")
+
+    def test_command_then_upload(self):
+        # garbage after a normal command doesn't leak into the next upload
+        usb = FakeUSB([b"fingerprint\r\njunk"])
+        host = get_usbhost(usb)
+        fname = host.read_to_file()
+        self.assertEqual(read_file(fname), b"fingerprint")
+        self.assertEqual(host.tail, b"")
+        usb.packets = [b"upl", b"oad 3\r"]
+        usb.stream = b"\nxyz"
+        self.assertEqual(self.upload(host), b"xyz")
+        # cleanup drops the state of an aborted upload
+        usb.packets = [b"upload 10\r\nabc"]
+        host.read_to_file()
+        host.cleanup()
+        self.assertEqual(host.tail, b"")
+
+
+class USBSendTest(TestCase):
+
+    def test_partial_writes(self):
+        # host reads only a few bytes at a time
+        data = bytes(range(256)) * 40
+        usb = FakeUSB(write_limit=100)
+        host = get_usbhost(usb)
+        host.SEND_CHUNK = 1000
+        asyncio.run(host._send_data(BytesIO(data), length_header=True))
+        self.assertEqual(usb.out, b"length %d\r\n" % len(data) + data + b"\r\n")
+
+    def test_send_timeout(self):
+        # host doesn't read at all
+        usb = FakeUSB(write_limit=0)
+        host = get_usbhost(usb)
+        host.UPLOAD_TIMEOUT = 10
+        with self.assertRaises(HostError):
+            asyncio.run(host._send_data(BytesIO(b"data")))
+
+
+class SDStreamTest(TestCase):
+
+    def tearDown(self):
+        profiler.clear()
+        profiler.enable(False)
+
+    def test_prefixed_stream(self):
+        profiler.enable()
+        profiler.clear()
+        s = PrefixedStream(b"sign ", BytesIO(b"cHNidP8B" * 100))
+        self.assertEqual(s.read(3), b"sig")
+        self.assertEqual(s.read(4), b"n cH")
+        buf = bytearray(6)
+        self.assertEqual(s.readinto(buf), 6)
+        self.assertEqual(buf, b"NidP8B")
+        # only bytes actually read from the file are counted
+        self.assertEqual(profiler._io["sd"][0], 8)
+        s.seek(0)
+        self.assertEqual(s.read(), b"sign " + b"cHNidP8B" * 100)
+        self.assertEqual(s.seek(0, 2), 805)
+        self.assertEqual(profiler._io["sd"][0], 808)
+
+
+class HostWakeupTest(TestCase):
+
+    def get_host(self):
+        clear_testdir()
+        platform.maybe_mkdir(TEST_DIR)
+        return Host(TEST_DIR + "/host")
+
+    def elapsed(self, coro):
+        t0 = time.ticks_ms()
+        asyncio.run(coro)
+        return time.ticks_diff(time.ticks_ms(), t0)
+
+    def test_polling(self):
+        host = self.get_host()
+        # without IRQs the host only sleeps for the poll interval
+        self.assertTrue(self.elapsed(host.wait(1000, poll=1)) < 500)
+
+    def test_wakeup(self):
+        host = self.get_host()
+        if not host.enable_wakeup():
+            # asyncio without ThreadSafeFlag, only polling is possible
+            return
+
+        async def irq():
+            await asyncio.sleep_ms(10)
+            host.wakeup()
+
+        async def run():
+            # IRQ wakes the host before the timeout
+            t0 = time.ticks_ms()
+            asyncio.create_task(irq())
+            await host.wait(2000)
+            self.assertTrue(time.ticks_diff(time.ticks_ms(), t0) < 1000)
+            # no IRQ - waits until the timeout
+            t0 = time.ticks_ms()
+            await host.wait(50)
+            self.assertTrue(time.ticks_diff(time.ticks_ms(), t0) >= 50)
+
+        asyncio.run(run())
+
+    def test_pending(self):
+        # data left in the USB buffer is processed without waiting for IRQ
+        usb = FakeUSB([b"rest"])
+        host = get_usbhost(usb)
+        self.assertTrue(host.pending())
+        usb.packets = []
+        self.assertFalse(host.pending())
@@ -78,3 +78,154 @@ class FlashKeyStoreTest(TestCase):
         files = [f[0] for f in os.ilistdir(TEST_DIR)]
         self.assertFalse("secret" in files)
         self.assertFalse("pin" in files)
+
+
+class DerivationCacheTest(TestCase):
+
+    def test_derive(self):
+        from keystore.ram import DerivationCache
+        from embit import bip32
+        root = bip32.HDKey.from_seed(b"\x01" * 64)
+        cache = DerivationCache(root)
+        paths = [
+            bip32.parse_path("m/84h/1h/0h/0/%d" % i) for i in range(3)
+        ] + [bip32.parse_path("m/84h/1h/0h/1/0")]
+        for path in paths:
+            self.assertEqual(cache.derive(path).to_base58(), root.derive(path).to_base58())
+        # account prefix is derived once and reused
+        self.assertTrue(tuple(paths[0][:3]) in cache.nodes)
+        self.assertTrue(cache.nodes.hits > 0)
+        # only parents are kept: 3 account levels and 2 branches
+        for path in paths:
+            self.assertFalse(tuple(path) in cache.nodes)
+        self.assertEqual(len(cache.nodes), 5)
+
+    def test_keystore_cache(self):
+        from .util import get_keystore
+        ks = get_keystore()
+        xpub = ks.get_xpub("m/84h/1h/0h")
+        self.assertEqual(xpub.to_base58(), ks.root.derive("m/84h/1h/0h").to_public().to_base58())
+        self.assertTrue(len(ks.derivation_cache.nodes) > 0)
+        self.assertTrue(len(ks.derivation_cache.nodes) <= ks.DERIVATION_CACHE_SIZE)
+        # no derived nodes are kept after lock
+        ks.lock()
+        self.assertTrue(ks._derivation_cache is None)
+
+
+class AEADTest(TestCase):
+
+    def test_aead_stream(self):
+        from io import BytesIO
+        from helpers import aead_encrypt, aead_decrypt, aead_encrypt_stream, aead_decrypt_stream
+        key = b"\x02" * 32
+        for l in [0, 1, 16, 511, 512, 2000]:
+            plaintext = bytes([i % 251 for i in range(l)])
+            b = BytesIO()
+            aead_encrypt_stream(key, b, b"adata", BytesIO(plaintext), chunk_size=64)
+            ct = b.getvalue()
+            # same format as the in-memory version
+            self.assertEqual(aead_decrypt(ct, key), (b"adata", plaintext))
+            self.assertEqual(aead_decrypt(aead_encrypt(key, b"adata", plaintext), key), (b"adata", plaintext))
+            out = BytesIO()
+            self.assertEqual(aead_decrypt_stream(BytesIO(ct), key, out, chunk_size=32), (b"adata", l))
+            self.assertEqual(out.getvalue(), plaintext)
+            # nothing is decrypted if HMAC is wrong
+            bad = bytearray(ct)
+            bad[8] ^= 1
+            out = BytesIO()
+            with self.assertRaises(Exception):
+                aead_decrypt_stream(BytesIO(bad), key, out)
+            self.assertEqual(out.getvalue(), b"")
+
+    def test_save_aead(self):
+        from .util import get_keystore
+        ks = get_keystore()
+        platform.maybe_mkdir(TEST_DIR)
+        fname = TEST_DIR + "/aead"
+        ks.save_aead(fname, adata=b"adata", plaintext=b"old")
+        ks.save_aead(fname, adata=b"adata", plaintext=b"new")
+        self.assertEqual(ks.load_aead(fname), (b"adata", b"new"))
+
+        class BrokenStream:
+            def readinto(self, *args):
+                raise ValueError("broken")
+            read = readinto
+
+        # failed write keeps the previous file
+        with self.assertRaises(ValueError):
+            ks.save_aead(fname, plaintext=BrokenStream())
+        self.assertEqual(ks.load_aead(fname), (b"adata", b"new"))
+        self.assertFalse(platform.file_exists(fname + ".tmp"))
+        # reset after the old file is removed - complete temp file is used
+        os.rename(fname, fname + ".tmp")
+        self.assertTrue(platform.recover_file(fname))
+        self.assertEqual(ks.load_aead(fname), (b"adata", b"new"))
+        os.rename(fname, fname + ".tmp")
+        self.assertEqual(ks.load_aead(fname), (b"adata", b"new"))
+        # reset while the temp file is written - old file is used
+        with open(fname + ".tmp", "wb") as f:
+            f.write(b"partial")
+        self.assertEqual(ks.load_aead(fname), (b"adata", b"new"))
+        self.assertFalse(platform.file_exists(fname + ".tmp"))
+        os.remove(fname)
+        self.assertFalse(platform.recover_file(fname))
+
+
+class SecureChannelTest(TestCase):
+
+    def get_channel(self, errors):
+        from keystore.javacard.applets.securechannel import SecureChannel
+        from keystore.javacard.applets.applet import ISOException
+
+        class FakeApplet:
+            """Raises ISOException with the next status word from errors"""
+            def __init__(self):
+                self.requests = 0
+
+            def request(self, apdu):
+                self.requests += 1
+                if errors:
+                    raise ISOException(errors.pop(0))
+                return apdu
+
+        class PlainChannel(SecureChannel):
+            """No crypto, only session bookkeeping"""
+            def open(self):
+                self.is_open = True
+                self.iv = 0
+                self.handshakes += 1
+
+            def encrypt(self, data):
+                return data
+
+            def decrypt(self, ct):
+                return self.SUCCESS + ct[len(self.SECURE_MSG) + 1:]
+
+        return PlainChannel(FakeApplet())
+
+    def test_session_lost(self):
+        sc = self.get_channel(["6985"])
+        self.assertEqual(sc.request(b"data"), b"data")
+        # reopened once and sent again
+        self.assertEqual(sc.handshakes, 2)
+        self.assertEqual(sc.applet.requests, 2)
+        # session is reused
+        sc.request(b"data")
+        self.assertEqual(sc.handshakes, 2)
+
+    def test_no_retry(self):
+        from keystore.javacard.applets.applet import ISOException
+        # other errors are not retried
+        sc = self.get_channel(["6a80"])
+        with self.assertRaises(ISOException):
+            sc.request(b"data")
+        self.assertEqual(sc.applet.requests, 1)
+        self.assertTrue(sc.is_open)
+        # PIN commands go over a fresh session and are sent once
+        sc = self.get_channel(["6985"])
+        sc.open()
+        with self.assertRaises(ISOException):
+            sc.request(b"pin", resume=False)
+        self.assertEqual(sc.applet.requests, 1)
+        self.assertEqual(sc.handshakes, 2)
+        self.assertFalse(sc.is_open)
@@ -0,0 +1,63 @@
+from unittest import TestCase
+import math
+from gui.components.qrcode import FrameCache, auto_density
+
+
+class PartsEncoder:
+    """Counts how many times every part was encoded"""
+    is_infinite = False
+
+    def __init__(self, parts):
+        self.parts = parts
+        self.calls = [0] * len(parts)
+
+    def __getitem__(self, idx):
+        self.calls[idx] += 1
+        return self.parts[idx]
+
+
+class SizeEncoder:
+    """Has only the size of the data, part_len must not be touched"""
+
+    def __init__(self, size):
+        self.size = size
+
+    def num_parts(self, part_len):
+        return math.ceil(self.size / part_len)
+
+
+class FrameCacheTest(TestCase):
+
+    def test_cache(self):
+        enc = PartsEncoder(["aaaa", "bbbb", "cc"])
+        cache = FrameCache(8)
+        for _ in range(3):
+            for i in range(3):
+                self.assertEqual(cache.get(enc, i), enc.parts[i])
+        # first two frames fit in the cache, the last one is encoded every time
+        self.assertEqual(enc.calls, [1, 1, 3])
+        self.assertEqual(cache.size, 8)
+        # density change invalidates the cache
+        cache.clear()
+        cache.get(enc, 0)
+        self.assertEqual(enc.calls[0], 2)
+
+    def test_infinite(self):
+        enc = PartsEncoder(["aaaa", "bbbb"])
+        enc.is_infinite = True
+        cache = FrameCache(100)
+        cache.get(enc, 0)
+        cache.get(enc, 0)
+        self.assertEqual(enc.calls[0], 2)
+        self.assertEqual(cache.size, 0)
+
+
+class AutoDensityTest(TestCase):
+
+    def test_auto_density(self):
+        # small data - the sparsest version
+        self.assertEqual(auto_density(SizeEncoder(100), 10, 10), 1)
+        # density grows until data fits in 10 frames of 230 bytes
+        self.assertEqual(auto_density(SizeEncoder(2000), 10, 10), 7)
+        # huge data - the densest allowed version
+        self.assertEqual(auto_density(SizeEncoder(100000), 10, 10), 10)
@@ -0,0 +1,116 @@
+from unittest import TestCase
+import ramstore
+import platform
+from .util import TEST_DIR, clear_testdir
+
+
+class RAMStoreTest(TestCase):
+
+    def tearDown(self):
+        ramstore._store = None
+
+    def test_files(self):
+        clear_testdir()
+        root = TEST_DIR + "/ram"
+        platform.maybe_mkdir(TEST_DIR)
+        platform.maybe_mkdir(root)
+        store = ramstore.init(root, 8 * ramstore.CHUNK_SIZE)
+        data = bytes(range(256)) * 10
+        with ramstore.open(root + "/a", "wb") as f:
+            f.write(data[:100])
+            f.write(data[100:])
+        self.assertTrue(ramstore.exists(root + "/a"))
+        self.assertEqual(ramstore.size(root + "/a"), len(data))
+        with ramstore.open(root + "/a", "rb") as f:
+            self.assertEqual(f.read(10), data[:10])
+            f.seek(1500)
+            self.assertEqual(f.read(), data[1500:])
+            f.seek(-5, 2)
+            buf = bytearray(10)
+            self.assertEqual(f.readinto(buf), 5)
+        with ramstore.open(root + "/a", "ab") as f:
+            f.write(b"tail")
+        with ramstore.open(root + "/a", "rb") as f:
+            self.assertEqual(f.read(), data + b"tail")
+        # all files removed - arena is rewound and freed
+        ramstore.delete_recursively(root)
+        self.assertEqual(store.used, 0)
+        self.assertEqual(store.top, 0)
+        self.assertTrue(store.buf is None)
+        # and allocated again for the next file
+        with ramstore.open(root + "/b", "wb") as f:
+            f.write(b"data")
+        self.assertTrue(store.buf is not None)
+        # rewriting the only file keeps the arena
+        buf = store.buf
+        with ramstore.open(root + "/b", "wb") as f:
+            f.write(b"new")
+        self.assertTrue(store.buf is buf)
+        self.assertEqual(store.used, ramstore.CHUNK_SIZE)
+        ramstore.remove(root + "/b")
+
+    def test_spill(self):
+        clear_testdir()
+        root = TEST_DIR + "/ram"
+        platform.maybe_mkdir(TEST_DIR)
+        platform.maybe_mkdir(root)
+        store = ramstore.init(root, ramstore.MIN_CHUNKS * ramstore.CHUNK_SIZE)
+        data = b"1234567890" * (ramstore.MIN_CHUNKS * ramstore.CHUNK_SIZE // 8)
+        with ramstore.open(root + "/big", "wb") as f:
+            f.write(data)
+        # arena is full - file lives on the filesystem now
+        self.assertFalse(root + "/big" in store.files)
+        self.assertEqual(store.used, 0)
+        with ramstore.open(root + "/big", "rb") as f:
+            self.assertEqual(f.read(), data)
+        # paths outside of the root are not stored
+        with ramstore.open(TEST_DIR + "/outside", "wb") as f:
+            f.write(b"test")
+        self.assertEqual(len(store.files), 0)
+        ramstore.remove(TEST_DIR + "/outside")
+        ramstore.remove(root + "/big")
+        self.assertFalse(ramstore.exists(root + "/big"))
+
+    def test_stale_handles(self):
+        clear_testdir()
+        root = TEST_DIR + "/ram"
+        platform.maybe_mkdir(TEST_DIR)
+        platform.maybe_mkdir(root)
+        store = ramstore.init(root, 8 * ramstore.CHUNK_SIZE)
+        with ramstore.open(root + "/a", "wb") as f:
+            f.write(b"a" * 2000)
+        f = ramstore.open(root + "/a", "rb")
+        # last file is removed - arena is rewound, reused by the next file
+        ramstore.remove(root + "/a")
+        self.assertEqual(store.top, 0)
+        with ramstore.open(root + "/b", "wb") as fb:
+            fb.write(b"b" * 2000)
+        with self.assertRaises(OSError):
+            f.read()
+        f.close()
+        # rewriting the file invalidates its readers too
+        f = ramstore.open(root + "/b", "rb")
+        with ramstore.open(root + "/b", "wb") as fb:
+            fb.write(b"c")
+        with self.assertRaises(OSError):
+            f.read(1)
+        f.close()
+        ramstore.delete_recursively(root)
+
+    def test_readline(self):
+        clear_testdir()
+        root = TEST_DIR + "/ram"
+        platform.maybe_mkdir(TEST_DIR)
+        platform.maybe_mkdir(root)
+        ramstore.init(root, 8 * ramstore.CHUNK_SIZE)
+        # lines crossing chunk boundaries
+        lines = [b"x" * 1500 + b"\n", b"short\n", b"\n", b"y" * 700 + b"\n", b"no eol"]
+        with ramstore.open(root + "/lines", "wb") as f:
+            f.write(b"".join(lines))
+        with ramstore.open(root + "/lines", "rb") as f:
+            self.assertEqual(f.readline(), lines[0])
+            self.assertEqual(f.readline(3), b"sho")
+            self.assertEqual(f.readline(), b"rt\n")
+        with ramstore.open(root + "/lines", "rb") as f:
+            self.assertEqual([line for line in f], lines)
+        ramstore.delete_recursively(root)
@@ -6,6 +6,8 @@ from embit.psbt import PSBT
 from embit.psbtview import PSBTView
 from embit.liquid.psetview import PSETView
 from apps.wallets.wallet import WalletError
+from helpers import ReadCounter
+from apps.wallets.scopeindex import ScopeIndex
 from io import BytesIO
 
 PSBTS = {
@@ -76,6 +78,159 @@ class SignTest(TestCase):
         sig_count = wapp.manager.sign_psbtview(psbtv, b, wallets, None)
         self.assertTrue(check_sigs(PSBT.parse(b.getvalue()), PSBT.from_string(signed)))
 
+    def test_wallet_index(self):
+        clear_testdir()
+        ks = get_keystore(mnemonic="ability "*11+"acid", password="")
+        wapp = get_wallets_app(ks, 'regtest')
+        # add a few foreign wallets that can't own the inputs
+        xpub = "tpubDCZWxJ6kKqRHep5a2XycxrXRaTES1vs3ysfV7sdv5uhkaEgxBEdVbyQT46m3NcaLJqVNd41TYqDyQfvweLLXGmkxdHRnhxuJPf7BAWMXni2"
+        for i in range(5):
+            w = wapp.manager.parse_wallet("Foreign %d&wpkh([8cce63f8/84h/1h/%dh]%s/{0,1}/*)" % (i, i, xpub))
+            wapp.manager.add_wallet(w)
+        self.assertEqual(len(wapp.manager.wallets), 6)
+
+        unsigned, signed = PSBTS["wpkh"]
+        psbt = PSBT.from_string(unsigned)
+        # only default wallet is a candidate for our inputs
+        self.assertEqual(wapp.manager.get_scope_wallets(psbt.inputs[0]), [wapp.manager.wallets[0]])
+
+        s = BytesIO(psbt.serialize())
+        fout = BytesIO()
+        wallets, meta = wapp.manager.preprocess_psbt(s, fout)
+        self.assertEqual(len(wallets), 1)
+        self.assertTrue(wapp.manager.wallets[0] in wallets)
+        # foreign wallets were never checked
+        self.assertTrue(wapp.manager.fill_scope_avoided >= 5 * (len(psbt.inputs) + len(psbt.outputs)))
+
+        fout.seek(0)
+        psbtv = PSBTView.view(fout)
+        b = BytesIO()
+        wapp.manager.sign_psbtview(psbtv, b, wallets, None)
+        self.assertTrue(check_sigs(PSBT.parse(b.getvalue()), PSBT.from_string(signed)))
+
+        # deleted wallets are removed from the index
+        w = wapp.manager.wallets[-1]
+        wapp.manager.delete_wallet(w)
+        self.assertFalse(any([w in arr for arr in wapp.manager.wallet_index.values()]))
+
+    def sign_modes(self, wapp, raw, view_cls):
+        """Signs raw psbt with and without pipelining, returns (signed, bytes read, gaps)"""
+        results = []
+        w = wapp.manager.wallets[0]
+        gaps = list(w.gaps)
+        for pipelined in [False, True]:
+            wapp.manager.pipelined_signing = pipelined
+            # both modes start from the same gaps
+            w.gaps = list(gaps)
+            fout = BytesIO()
+            wallets, meta = wapp.manager.preprocess_psbt(BytesIO(raw), fout)
+            self.assertEqual(wapp.manager.sign_plan is not None, pipelined)
+            fout.seek(0)
+            f = ReadCounter(fout)
+            psbtv = view_cls.view(f, compress=True)
+            f.count = 0
+            b = BytesIO()
+            wapp.manager.sign_psbtview(psbtv, b, wallets, None)
+            results.append((b.getvalue(), f.count, list(w.gaps)))
+        wapp.manager.pipelined_signing = False
+        return results
+
+    def test_pipelined_signing(self):
+        clear_testdir()
+        ks = get_keystore(mnemonic="ability "*11+"acid", password="")
+        wapp = get_wallets_app(ks, 'regtest')
+        unsigned, signed = PSBTS["wpkh"]
+        results = self.sign_modes(wapp, PSBT.from_string(unsigned).serialize(), PSBTView)
+        for res in results:
+            self.assertTrue(check_sigs(PSBT.parse(res[0]), PSBT.from_string(signed)))
+        # same result with less data read
+        self.assertEqual(results[0][0], results[1][0])
+        self.assertEqual(results[0][2], results[1][2])
+        self.assertTrue(results[1][1] < results[0][1])
+
+    def test_sighash_context(self):
+        """Common sighash hashes are computed once, not once per input"""
+        from embit import hashes
+        from embit.psbt import DerivationPath
+        from embit.transaction import Transaction, TransactionInput, TransactionOutput
+        clear_testdir()
+        ks = get_keystore(mnemonic="ability "*11+"acid", password="")
+        wapp = get_wallets_app(ks, 'regtest')
+        w = wapp.manager.wallets[0]
+
+        def make_psbt(n):
+            tx = Transaction(
+                vin=[TransactionInput(hashes.sha256(i.to_bytes(4, "little")), 0) for i in range(n)],
+                vout=[TransactionOutput(n * 100000 - 1000, w.derive(0, 1).script_pubkey())],
+            )
+            psbt = PSBT(tx)
+            for i, inp in enumerate(psbt.inputs):
+                desc = w.derive(i, 0)
+                for key in desc.keys:
+                    inp.bip32_derivations[key.get_public_key()] = DerivationPath(key.fingerprint, key.derivation)
+                inp.witness_utxo = TransactionOutput(100000, desc.script_pubkey())
+            return psbt
+
+        per_input = []
+        for n in [5, 20]:
+            fout = BytesIO()
+            wallets, meta = wapp.manager.preprocess_psbt(BytesIO(make_psbt(n).serialize()), fout)
+            fout.seek(0)
+            f = ReadCounter(fout)
+            psbtv = PSBTView.view(f, compress=True)
+            f.count = 0
+            b = BytesIO()
+            wapp.manager.sign_psbtview(psbtv, b, wallets, None)
+            self.assertEqual(len([inp for inp in PSBT.parse(b.getvalue()).inputs if inp.partial_sigs]), n)
+            per_input.append(f.count / n)
+        # hashPrevouts, hashSequence and hashOutputs read all inputs and outputs,
+        # recomputing them for every input would make reads per input grow with n
+        self.assertTrue(per_input[1] < 1.5 * per_input[0])
+
+    def test_wallet_persistence(self):
+        clear_testdir()
+        ks = get_keystore(mnemonic="ability "*11+"acid", password="")
+        wapp = get_wallets_app(ks, 'regtest')
+        writes = []
+        save_aead = ks.save_aead
+        def counting_save_aead(path, *args, **kwargs):
+            writes.append(path)
+            return save_aead(path, *args, **kwargs)
+        ks.save_aead = counting_save_aead
+
+        unsigned, signed = PSBTS["wpkh"]
+        psbt = PSBT.from_string(unsigned)
+        for i in range(2):
+            writes.clear()
+            fout = BytesIO()
+            wallets, meta = wapp.manager.preprocess_psbt(BytesIO(psbt.serialize()), fout)
+            fout.seek(0)
+            wapp.manager.sign_psbtview(PSBTView.view(fout), BytesIO(), wallets, None)
+            # descriptor is never rewritten, second signing doesn't change gaps
+            self.assertFalse(any([p.endswith("/descriptor") for p in writes]))
+            if i > 0:
+                self.assertEqual(writes, [])
+        gaps = list(wapp.manager.wallets[0].gaps)
+
+        # wallets are restored from the registry without parsing descriptors
+        ks.save_aead = save_aead
+        wapp = get_wallets_app(ks, 'regtest')
+        w = wapp.manager.wallets[0]
+        self.assertFalse(w.is_loaded)
+        self.assertEqual(w.gaps, gaps)
+        self.assertEqual(wapp.manager.get_scope_wallets(psbt.inputs[0]), [w])
+
+    def test_scope_index(self):
+        unsigned, signed = PSBTS["wpkh"]
+        psbtv = PSBTView.view(BytesIO(PSBT.from_string(unsigned).serialize()), compress=True)
+        index = ScopeIndex(psbtv)
+        self.assertEqual(len(index), psbtv.num_inputs + psbtv.num_outputs)
+        for i in range(len(index)):
+            self.assertEqual(index.scope_offset(i), psbtv.seek_to_scope(i))
+            for key in [b"\x00", b"\x01", b"\x07", b"\x08"]:
+                psbtv.seek_to_scope(i)
+                self.assertEqual(index.seek_to_value(i, key), psbtv.seek_to_value(key, from_current=True))
+
     def test_pset(self):
         clear_testdir()
         mnemonic = "ceiling retire saddle forest engine address fancy option fruit destroy grid strategy"
@@ -137,6 +292,13 @@ class SignTest(TestCase):
             self.assertEqual(out1.value_blinding_factor, out2.value_blinding_factor)
             self.assertEqual(out1.surjection_proof, out2.surjection_proof)
 
+        # pipelined signing of the pset gives the same result with less data read
+        results = self.sign_modes(wapp, s.getvalue(), PSETView)
+        self.assertEqual(results[0][0], b.getvalue())
+        self.assertEqual(results[0][0], results[1][0])
+        self.assertEqual(results[0][2], results[1][2])
+        self.assertTrue(results[1][1] < results[0][1])
+
     def test_invalid_pset(self):
         clear_testdir()
         mnemonic = "ceiling retire saddle forest engine address fancy option fruit destroy grid strategy"
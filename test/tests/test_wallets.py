@@ -1,5 +1,10 @@
 from unittest import TestCase
+import os
 from apps.wallets.wallet import Wallet
+from apps.wallets.liquid.wallet import LWallet
+from embit import ec, script
+from embit.psbt import DerivationPath
+from binascii import unhexlify
 from embit.descriptor import Key
 
 TEST_DIR = "testdir"
@@ -62,3 +67,175 @@ class WalletsTest(TestCase):
         d = "tr([73c5da0a/2/2/2]tpubDCPwGho2toLmdSELZ3o8v1D6RUUK7Y5keCjMyrSfE75aX2Mcx4MNEM6MnXDZR87GQ1ot4YNn2GGtiN5SvM12c6cvYMrt6avwtYNcRab2HFv/<0;1>/*,or_b(pk([73c5da0a/1/2/3]tpubDCpEkdSHkygNaquCRtW8Fuo3TchAXFSWUuYB9aryim58T4CWM9vLgt26uUV5wdtuvbSk7rWmQQCpcYhGjbHiBzWCYXeyRMJ98zSBWekaJJm/<0;1>/*),s:pk([73c5da0a/3/2/1]tpubDDrLDbxjL1d5FK8djVqUjD3xL1gkhaTXTL1rHzEavwA2ss4YpF8Qm82cKN89PEBRYk6JVTZULA872LuFGENTGdNYASDCrXKKZkU86A8HLqA/<0;1>/*)))"
         w = Wallet.parse(d)
         print(w)
+
+    def test_derive_cache(self):
+        k = "[8cce63f8/84h/1h/0h]tpubDCZWxJ6kKqRHep5a2XycxrXRaTES1vs3ysfV7sdv5uhkaEgxBEdVbyQT46m3NcaLJqVNd41TYqDyQfvweLLXGmkxdHRnhxuJPf7BAWMXni2/<0;1>/*"
+        w = Wallet.parse("wpkh(%s)" % k)
+        d1, _ = w.get_descriptor(5, 1)
+        d2, _ = w.get_descriptor(5, 1)
+        self.assertTrue(d1 is d2)
+        self.assertEqual(w.script_pubkey([1, 5])[0], w.descriptor.derive(5, branch_index=1).script_pubkey())
+        # cache never grows above its limit
+        for i in range(2 * w._derived.size):
+            w.get_descriptor(i)
+        self.assertEqual(len(w._derived), w._derived.size)
+        self.assertEqual(w.get_address(0, "test")[0], w.descriptor.derive(0).address(w.Networks["test"]))
+
+    def test_owns(self):
+        H = 0x80000000
+        fp = unhexlify("8cce63f8")
+        k = "[8cce63f8/84h/1h/0h]tpubDCZWxJ6kKqRHep5a2XycxrXRaTES1vs3ysfV7sdv5uhkaEgxBEdVbyQT46m3NcaLJqVNd41TYqDyQfvweLLXGmkxdHRnhxuJPf7BAWMXni2/<0;1>/*"
+        w = Wallet.parse("wpkh(%s)" % k)
+        desc = w.descriptor.derive(3, branch_index=1)
+        pub = desc.keys[0].get_public_key()
+        sc = desc.script_pubkey()
+        der = [84 + H, 1 + H, 0 + H, 1, 3]
+
+        class Scope:
+            def __init__(self, script_pubkey, ders):
+                self.script_pubkey = script_pubkey
+                self.bip32_derivations = ders
+                self.taproot_bip32_derivations = {}
+
+        cases = [
+            (Scope(sc, {pub: DerivationPath(fp, der)}), True),
+            # foreign fingerprint
+            (Scope(sc, {pub: DerivationPath(b"\x00" * 4, der)}), False),
+            # our key, other account
+            (Scope(sc, {pub: DerivationPath(fp, [84 + H, 1 + H, 1 + H, 1, 3])}), False),
+            # derivation doesn't match the script
+            (Scope(sc, {pub: DerivationPath(fp, der[:-1] + [4])}), False),
+            # derivation matches, script doesn't
+            (Scope(script.p2wpkh(ec.PrivateKey(b"\x11" * 32).get_public_key()), {pub: DerivationPath(fp, der)}), False),
+            (Scope(script.p2pkh(pub), {pub: DerivationPath(fp, der)}), False),
+            (Scope(None, {pub: DerivationPath(fp, der)}), False),
+        ]
+        for scope, res in cases:
+            self.assertEqual(w.owns(scope), res)
+            self.assertEqual(w.descriptor.owns(scope), res)
+        # pubkeys are cached with the child descriptor
+        self.assertEqual(w.derived_keys(3, 1), [(fp, pub, der)])
+        self.assertTrue(w.derived_keys(3, 1) is w.derived_keys(3, 1))
+
+    def test_address_pages(self):
+        k = "[8cce63f8/48h/1h/0h/2h]tpubDCZWxJ6kKqRHep5a2XycxrXRaTES1vs3ysfV7sdv5uhkaEgxBEdVbyQT46m3NcaLJqVNd41TYqDyQfvweLLXGmkxdHRnhxuJPf7BAWMXni2/<0;1>/*"
+        w = Wallet.parse("wsh(sortedmulti(1,%s,%s))" % (k, k.replace("/<0;1>", "/<2;3>")))
+        net = w.Networks["test"]
+        for branch in range(2):
+            expected = [w.descriptor.derive(i, branch_index=branch).address(net) for i in range(7, 19)]
+            self.assertEqual(w.get_addresses(7, 12, "test", branch), expected)
+            self.assertEqual(w.get_address(8, "test", branch)[0], expected[1])
+        page = w.address_page(3, "test", 1)
+        self.assertEqual(len(page), w.ADDRESS_PAGE_SIZE)
+        self.assertTrue(w.address_page(3, "test", 1) is page)
+        self.assertEqual(w.find_cached_address(page[2], "test"), (3 * w.ADDRESS_PAGE_SIZE + 2, 1))
+        self.assertEqual(w.find_cached_address(page[2], "main"), None)
+        # only recently displayed pages are kept
+        for i in range(w.ADDRESS_PAGES):
+            w.address_page(10 + i, "test")
+        self.assertEqual(w.find_cached_address(page[2], "test"), None)
+
+    def test_branch_descriptor(self):
+        xpub = "tpubDCZWxJ6kKqRHep5a2XycxrXRaTES1vs3ysfV7sdv5uhkaEgxBEdVbyQT46m3NcaLJqVNd41TYqDyQfvweLLXGmkxdHRnhxuJPf7BAWMXni2"
+        k = "[8cce63f8/48h/1h/0h/2h]%s/<0;1>/*" % xpub
+        # key without origin and with a fixed step before the branch
+        k2 = "%s/7/<2;3>/*" % xpub
+        slip77 = str(ec.PrivateKey(b"\x11" * 32))
+        cases = [
+            (Wallet, "wsh(multi(2,%s,%s))" % (k, k2), "test"),
+            (LWallet, "blinded(slip77(%s),wsh(sortedmulti(1,%s,%s)))" % (slip77, k, k2), "elementsregtest"),
+        ]
+        for cls, d, network in cases:
+            w = cls.parse(d)
+            net = w.Networks[network]
+            for branch in range(2):
+                derived = [w.descriptor.derive(i, branch_index=branch) for i in range(3, 9)]
+                expected = [desc.address(net) for desc in derived]
+                self.assertEqual(w.get_addresses(3, 6, network, branch), expected)
+                for i, desc in enumerate(derived):
+                    self.assertEqual(w.get_address(3 + i, network, branch)[0], expected[i])
+                    # branch keys derive the same children with the same origins
+                    child = w.branch_descriptor(branch).derive(3 + i)
+                    self.assertEqual(str(child), str(desc))
+
+    def test_registry_header(self):
+        k = "[8cce63f8/84h/1h/0h]tpubDCZWxJ6kKqRHep5a2XycxrXRaTES1vs3ysfV7sdv5uhkaEgxBEdVbyQT46m3NcaLJqVNd41TYqDyQfvweLLXGmkxdHRnhxuJPf7BAWMXni2/<0;1>/*"
+        w = Wallet.parse("Test&wsh(sortedmulti(1,%s,%s))" % (k, k))
+        w.gaps = [25, 30]
+        header = w.get_header()
+
+        class FakeKeyStore:
+            loads = 0
+            def load_aead(self, path):
+                self.loads += 1
+                return b"", str(w.descriptor).encode()
+
+        ks = FakeKeyStore()
+        lazy = Wallet.from_header(None, header, ks)
+        lazy.path = "wallet"
+        # header data is available without loading the descriptor
+        self.assertEqual(lazy.name, "Test")
+        self.assertEqual(lazy.gaps, [25, 30])
+        self.assertEqual(lazy.fingerprint, w.fingerprint)
+        self.assertEqual(lazy.key_origins, w.key_origins)
+        self.assertEqual(lazy.is_watchonly, w.is_watchonly)
+        self.assertFalse(lazy.is_loaded)
+        self.assertEqual(ks.loads, 0)
+        # descriptor is parsed on first use
+        self.assertEqual(lazy.get_address(3, "test"), w.get_address(3, "test"))
+        self.assertTrue(lazy.is_loaded)
+        self.assertEqual(ks.loads, 1)
+
+    def test_asset_index(self):
+        import platform
+        from apps.wallets.liquid.assets import AssetIndex
+        try:
+            platform.delete_recursively(TEST_DIR, include_self=True)
+        except:
+            pass
+        platform.maybe_mkdir(TEST_DIR)
+        idx = AssetIndex(TEST_DIR + "/assets", b"k" * 32)
+        assets = {bytes([i]) * 32: "A%d" % i for i in range(40)}
+        # first half goes through the journal, second - in one merge
+        for i, asset in enumerate(assets):
+            if i < 20:
+                idx.add(asset, assets[asset])
+        idx.update({a: assets[a] for i, a in enumerate(assets) if i >= 20})
+        for asset in assets:
+            self.assertEqual(idx.get(asset), assets[asset])
+        self.assertEqual(idx.get(b"\xff" * 32), None)
+        # relabel is visible before and after merge
+        asset = bytes([3]) * 32
+        idx.add(asset, "NEW")
+        self.assertEqual(idx.get(asset), "NEW")
+        idx.merge()
+        self.assertEqual(idx.get(asset), "NEW")
+        self.assertEqual(len(list(idx.items())), len(assets))
+        # long labels are kept in full through the merge
+        idx.add(asset, "X" * 100)
+        self.assertEqual(idx.get(asset), "X" * 100)
+        idx.merge()
+        self.assertEqual(idx.get(asset), "X" * 100)
+        self.assertEqual(dict(idx.items())[asset], "X" * 100)
+        # reset after the new index is written but before the old one is replaced
+        idx.add(asset, "Y")
+        with open(idx.index_file, "rb") as f:
+            old_index = f.read()
+        with open(idx.journal_file, "rb") as f:
+            journal = f.read()
+        idx.merge()
+        os.rename(idx.index_file, idx.tmp_file)
+        for fname, data in [(idx.index_file, old_index), (idx.journal_file, journal)]:
+            with open(fname, "wb") as f:
+                f.write(data)
+        idx = AssetIndex(TEST_DIR + "/assets", b"k" * 32)
+        self.assertFalse(platform.file_exists(idx.tmp_file))
+        self.assertEqual(idx.get(asset), "Y")
+        # reset after the old index is removed
+        idx.add(asset, "Z")
+        idx.merge()
+        os.rename(idx.index_file, idx.tmp_file)
+        idx = AssetIndex(TEST_DIR + "/assets", b"k" * 32)
+        self.assertFalse(platform.file_exists(idx.tmp_file))
+        self.assertEqual(idx.get(asset), "Z")
+        self.assertEqual(idx.get(bytes([5]) * 32), "A5")